@@ -0,0 +1,154 @@
+#include "adc.h"
+#include "hardware.h"
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Inputs as MUXCTRL values, in the order of enum adc_input
+static const uint8_t muxes[ADC_N_INPUTS] = {
+    [ADC_IN_VCC] = ADC_CH_MUXINT_SCALEDVCC_gc,
+    [ADC_IN_TEMP] = ADC_CH_MUXINT_TEMP_gc,
+};
+
+static volatile int16_t results[ADC_N_INPUTS];
+static volatile uint8_t current = 0;
+static volatile uint16_t sample_count = 0;
+static volatile bool running = false;
+
+// Temperature sensor reading at 85 degC, converted to signed mode
+static int16_t temp_cal_85;
+
+static uint8_t read_calibration_byte(uint8_t index)
+{
+    NVM.CMD = NVM_CMD_READ_CALIB_ROW_gc;
+    uint8_t result = pgm_read_byte(index);
+    NVM.CMD = NVM_CMD_NO_OPERATION_gc;
+    return result;
+}
+
+void init_adc(void)
+{
+    ADC_ADC.CALL = read_calibration_byte(
+            offsetof(NVM_PROD_SIGNATURES_t, ADCACAL0));
+    ADC_ADC.CALH = read_calibration_byte(
+            offsetof(NVM_PROD_SIGNATURES_t, ADCACAL1));
+
+    // The temperature calibration was taken in unsigned mode, which reads
+    // ADC_UNSIGNED_OFFSET higher and has twice the counts per volt
+    uint16_t cal =
+        read_calibration_byte(offsetof(NVM_PROD_SIGNATURES_t, TEMPSENSE0)) |
+        read_calibration_byte(offsetof(NVM_PROD_SIGNATURES_t, TEMPSENSE1)) << 8;
+    temp_cal_85 = ((int16_t) cal - ADC_UNSIGNED_OFFSET) / 2;
+
+    // Signed mode, so that inputs near ground read as zero rather than in
+    // the unsigned mode's offset band
+    ADC_ADC.CTRLB = ADC_CONMODE_bm | ADC_RESOLUTION_12BIT_gc;
+    ADC_ADC.REFCTRL = ADC_REFSEL_INT1V_gc | ADC_BANDGAP_bm | ADC_TEMPREF_bm;
+    ADC_ADC.PRESCALER = ADC_PRESCALER;
+    ADC_ADC.CTRLA = ADC_ENABLE_bm;
+}
+
+// Run one conversion on channel 0.
+static int16_t convert(uint8_t inputmode, uint8_t muxctrl)
+{
+    ADC_ADC.CH0.MUXCTRL = muxctrl;
+    ADC_ADC.CH0.INTFLAGS = ADC_CH_IF_bm;
+    ADC_ADC.CH0.CTRL = inputmode | ADC_CH_START_bm;
+    while (!(ADC_ADC.CH0.INTFLAGS & ADC_CH_IF_bm));
+    return ADC_ADC.CH0.RES;
+}
+
+void adc_start_telemetry(void)
+{
+    current = 0;
+    ADC_ADC.CH0.MUXCTRL = muxes[0];
+    ADC_ADC.CH0.CTRL = ADC_CH_INPUTMODE_INTERNAL_gc;
+    // Each start takes ADC_AVERAGE samples and yields their average
+    ADC_ADC.CH0.AVGCTRL = ADC_AVGCTRL;
+    ADC_ADC.CH0.INTFLAGS = ADC_CH_IF_bm;
+    ADC_ADC.CH0.INTCTRL = ADC_CH_INTLVL_LO_gc;
+
+    (&EVSYS.CH0MUX)[ADC_EVCH] = ADC_EVSRC;
+    ADC_ADC.EVCTRL = (ADC_EVCH << ADC_EVSEL_gp) | ADC_EVACT_CH0_gc;
+    running = true;
+}
+
+ISR(ADCA_CH0_vect)
+{
+    uint8_t i = current;
+    results[i] = ADC_ADC.CH0.RES;
+    ++sample_count;
+
+    // The next event starts the next input
+    if (++i == ADC_N_INPUTS) {
+        i = 0;
+    }
+    ADC_ADC.CH0.MUXCTRL = muxes[i];
+    current = i;
+}
+
+static int16_t result(uint8_t input)
+{
+    int16_t res;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        res = results[input];
+    }
+    return res;
+}
+
+uint16_t adc_vcc_mv(void)
+{
+    int16_t res = running
+        ? result(ADC_IN_VCC)
+        : convert(ADC_CH_INPUTMODE_INTERNAL_gc, ADC_CH_MUXINT_SCALEDVCC_gc);
+    if (res < 0) {
+        res = 0;
+    }
+    // Full scale of 2047 is the 1.0 V reference, and the input is VCC/10
+    return ((uint32_t) res * 10000 + 1023) / 2047;
+}
+
+int16_t adc_temp_dc(void)
+{
+    if (temp_cal_85 <= 0) {
+        return 0;
+    }
+    // The sensor output is proportional to absolute temperature
+    int32_t dk = (int32_t) result(ADC_IN_TEMP) * (2732 + 850) / temp_cal_85;
+    return dk - 2732;
+}
+
+uint16_t adc_sample_count(void)
+{
+    uint16_t n;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        n = sample_count;
+    }
+    return n;
+}
+
+uint16_t adc_wait_input_ramp(void)
+{
+    uint32_t start = uptime_ms();
+    uint32_t above_since = 0;
+    bool above = false;
+
+    for (;;) {
+        uint32_t now = uptime_ms();
+        if (now - start >= RAMP_MAX_MS) {
+            break;
+        }
+        if (adc_vcc_mv() < RAMP_VCC_MIN_MV) {
+            above = false;
+        } else if (!above) {
+            above = true;
+            above_since = now;
+        } else if (now - above_since >= RAMP_DWELL_MS) {
+            break;
+        }
+    }
+
+    return uptime_ms() - start;
+}
@@ -0,0 +1,40 @@
+#ifndef ADC_H
+#define ADC_H
+
+#include <inttypes.h>
+
+// ADC measurements. Until adc_start_telemetry(), conversions are polled. After
+// it, the ADC runs in the background: each event on ADC_EVCH starts a
+// hardware-averaged conversion, and its completion interrupt stores the
+// result and moves on to the next input.
+
+enum adc_input {
+    ADC_IN_VCC,     // VCC/10
+    ADC_IN_TEMP,    // die temperature sensor
+    ADC_N_INPUTS
+};
+
+void init_adc(void);
+
+// Start background conversions.
+void adc_start_telemetry(void);
+
+// Return the MCU supply voltage in mV, measured through the ADC's internal
+// VCC/10 input: the latest background result, or a fresh conversion before
+// adc_start_telemetry().
+uint16_t adc_vcc_mv(void);
+
+// Return the die temperature in 0.1 degC, from the latest background result
+// and the production calibration at 85 degC.
+int16_t adc_temp_dc(void);
+
+// Return the number of background conversions completed, wrapping.
+uint16_t adc_sample_count(void);
+
+// Wait for VCC to be at least RAMP_VCC_MIN_MV and stay there for
+// RAMP_DWELL_MS, or at most RAMP_MAX_MS in total. This only checks that the
+// MCU rail is stable; the input rail is not measured.
+// @return time taken in ms
+uint16_t adc_wait_input_ramp(void);
+
+#endif // ADC_H
@@ -0,0 +1,146 @@
+#include "bist.h"
+#include "hardware.h"
+#include <util/atomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+_Static_assert(&DCDC_SYNC_PORT == &PORTC,
+        "BIST routes SYNC pins through PORTC pin events");
+_Static_assert(BIST_EVCH != ADC_EVCH, "BIST and ADC need separate event channels");
+_Static_assert(BIST_EVCH >= 1,
+        "BIST capture channel B takes events from BIST_EVCH = EVSEL + 1");
+
+// Indexed by supply ID; the bucks come first
+static struct bist_result results[REG_N_BUCKS];
+
+#define BIST_MUX    ((&EVSYS.CH0MUX)[BIST_EVCH])
+
+void init_bist(void)
+{
+    // Capture channel B takes events from channel EVSEL + 1. Channel A
+    // stays in compare mode for the tick, and ignores events.
+    BIST_TIMER.CTRLD = TC45_EVACT_OFF_gc | (TC45_EVSEL_CH0_gc + BIST_EVCH - 1);
+    BIST_TIMER.CTRLE = (BIST_TIMER.CTRLE & ~TC45_CCBMODE_gm) | TC45_CCBMODE_CAPT_gc;
+}
+
+// Capture the timestamp of the next event from the current source, waiting
+// at most limit cycles of BIST_TIMER.
+// @return true on timeout
+static bool capture_next(uint16_t * stamp, uint16_t limit)
+{
+    uint16_t start = BIST_TIMER.CNT;
+    do {
+        if (BIST_TIMER.INTFLAGS & TC5_CCBIF_bm) {
+            *stamp = BIST_TIMER.CCB;
+            return false;
+        }
+    } while ((uint16_t) (BIST_TIMER.CNT - start) < limit);
+    return true;
+}
+
+// Switch to a new event source and capture its next event.
+static bool capture(uint8_t mux, uint16_t * stamp, uint16_t limit)
+{
+    BIST_MUX = mux;
+    // Drain anything captured from the previous source
+    (void) BIST_TIMER.CCB;
+    (void) BIST_TIMER.CCB;
+    BIST_TIMER.INTFLAGS = TC5_CCBIF_bm;
+    return capture_next(stamp, limit);
+}
+
+static int8_t clamp8(int16_t v)
+{
+    return v > 127 ? 127 : v < -128 ? -128 : v;
+}
+
+static void bist_run(uint8_t n)
+{
+    regptr reg = reg_of_id(n);
+    struct reg_buck const __memx * buck = reg__buck(reg);
+    struct bist_result res = { .status = BIST_SKIPPED };
+
+    if (buck->state->mode != BUCK_SYNC || buck->state->ss_left) {
+        results[n] = res;
+        return;
+    }
+
+    uint8_t pin_mux = EVSYS_CHMUX_PORTC_PIN0_gc + __builtin_ctz(buck->sync_bm);
+    uint8_t ovf_mux = (buck->timer == (TC4_t volatile *) &TCC4)
+        ? EVSYS_CHMUX_TCC4_OVF_gc : EVSYS_CHMUX_TCC5_OVF_gc;
+    uint16_t t0 = 0, t1 = 0, tovf = 0, tedge = 0;
+    bool timeout;
+
+    // Expected rising edge: at BOTTOM for phase 0, else on compare match
+    uint32_t expect_period = F_CPU / reg_buck_get_frequency(reg);
+    uint8_t phase = reg_buck_get_phase(reg);
+    uint16_t expect_edge = ((uint32_t) phase * expect_period + 128) >> 8;
+    uint32_t limit = expect_period * BIST_TIMEOUT_PERIODS;
+    if (limit > UINT16_MAX) {
+        limit = UINT16_MAX;
+    }
+
+    // Keep the tick, the supervisor and the shell from delaying the polls
+    // between captures, but leave the high-level power-fail interrupt
+    // enabled.
+    uint8_t pmic = PMIC.CTRL;
+    PMIC.CTRL = pmic & ~(PMIC_LOLVLEN_bm | PMIC_MEDLVLEN_bm);
+    timeout =
+        capture(pin_mux, &t0, limit) || capture_next(&t1, limit) ||
+        capture(ovf_mux, &tovf, limit) || capture(pin_mux, &tedge, limit);
+    PMIC.CTRL = pmic;
+
+    res.period = t1 - t0;
+    if (timeout || !res.period) {
+        res.status = BIST_NO_EDGE;
+        results[n] = res;
+        return;
+    }
+
+    res.edge = (uint16_t) (tedge - tovf - BIST_PIN_DELAY) % res.period;
+    res.period_err = clamp8((int16_t) (res.period - expect_period));
+    int16_t phase_err = (int16_t) (res.edge - expect_edge);
+    // Wrap into +-half a period
+    if (phase_err > (int16_t) (res.period / 2)) phase_err -= res.period;
+    if (phase_err < -(int16_t) (res.period / 2)) phase_err += res.period;
+    res.phase_err = clamp8(phase_err);
+
+    if (abs(res.period_err) > BIST_TOLERANCE) {
+        res.status = BIST_BAD_PERIOD;
+    } else if (abs(res.phase_err) > BIST_TOLERANCE) {
+        res.status = BIST_BAD_PHASE;
+    } else if (abs(res.period_err) > 1 || abs(res.phase_err) > 1) {
+        res.status = BIST_DRIFT;
+    } else {
+        res.status = BIST_PASS;
+    }
+    results[n] = res;
+}
+
+void bist_task(void)
+{
+    static uint8_t next = 0;
+    static uint32_t due_ms = 0;
+
+    if (in_standby() || (int32_t) (uptime_ms() - due_ms) < 0) {
+        return;
+    }
+
+    bist_run(next);
+    if (++next == REG_N_BUCKS) {
+        next = 0;
+        due_ms = uptime_ms() + BIST_INTERVAL_MS;
+    }
+}
+
+struct bist_result bist_get(regptr reg)
+{
+    struct bist_result res = { .status = BIST_NOT_RUN };
+    int8_t id = reg_id_of(reg);
+    if (id >= 0 && id < REG_N_BUCKS) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            res = results[id];
+        }
+    }
+    return res;
+}
@@ -0,0 +1,42 @@
+#ifndef BIST_H
+#define BIST_H
+
+#include "regulator.h"
+#include <inttypes.h>
+
+// Built-in self-test of the SYNC outputs. Each synchronized buck's SYNC pin
+// and its sync timer's overflow are routed through the event system into
+// capture channel B of BIST_TIMER, which measures the period of the output
+// and the position of its rising edge within the sync timer's period.
+
+enum bist_status {
+    BIST_NOT_RUN,
+    BIST_SKIPPED,       // buck not running synchronized
+    BIST_PASS,
+    BIST_DRIFT,         // off by more than rounding, within BIST_TOLERANCE
+    BIST_NO_EDGE,       // no edges seen on the SYNC pin
+    BIST_BAD_PERIOD,
+    BIST_BAD_PHASE,
+};
+
+struct bist_result {
+    uint8_t status;     // enum bist_status
+    int8_t period_err;  // measured minus expected, in cycles
+    int8_t phase_err;   // measured minus expected, in cycles
+    uint16_t period;    // measured period, in cycles
+    uint16_t edge;      // measured rising edge after the timer's BOTTOM, in cycles
+};
+
+void init_bist(void);
+
+// Test the next buck if a test is due. Call from the main loop; each call
+// masks low- and medium-level interrupts for at most four captures of
+// BIST_TIMEOUT_PERIODS sync periods each, leaving the power-fail interrupt
+// enabled. All bucks are tested on the first calls after boot, then every
+// BIST_INTERVAL_MS.
+void bist_task(void);
+
+// Return the latest result for a buck.
+struct bist_result bist_get(regptr reg);
+
+#endif // BIST_H
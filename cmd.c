@@ -0,0 +1,123 @@
+#include "cmd.h"
+#include "hardware.h"
+#include "fmt.h"
+#include <ctype.h>
+#include <string.h>
+
+static struct {
+    struct cmd const * table;
+    uint8_t n;
+} groups[CMD_MAX_GROUPS];
+static uint8_t n_groups = 0;
+
+bool cmd_register(struct cmd const * table, uint8_t n)
+{
+    if (n_groups >= CMD_MAX_GROUPS) {
+        return true;
+    }
+    groups[n_groups].table = table;
+    groups[n_groups].n = n;
+    ++n_groups;
+    return false;
+}
+
+#define MATCH_NONE      0
+#define MATCH_PREFIX    1
+#define MATCH_EXACT     2
+
+// Compare s with a name in flash, one flash read per character, stopping at
+// the first difference.
+static uint8_t compare(char const * s, PGM_P name)
+{
+    for (;; ++s, ++name) {
+        char c = pgm_read_byte(name);
+        if (!*s) {
+            return c ? MATCH_PREFIX : MATCH_EXACT;
+        }
+        if (tolower(*s) != tolower(c)) {
+            return MATCH_NONE;
+        }
+    }
+}
+
+int8_t cmd_lookup(char const * s, PGM_P names, uint8_t stride, uint8_t n)
+{
+    int8_t found = CMD_NONE;
+    for (uint8_t i = 0; i < n; ++i, names += stride) {
+        uint8_t m = compare(s, names);
+        if (m == MATCH_EXACT) {
+            return i;
+        } else if (m == MATCH_PREFIX) {
+            found = found == CMD_NONE ? (int8_t) i : CMD_AMBIGUOUS;
+        }
+    }
+    return found;
+}
+
+// Find a command across every table, or NULL, setting *ambiguous if more
+// than one matched by prefix.
+static struct cmd const * find(char const * s, bool * ambiguous)
+{
+    struct cmd const * found = NULL;
+    *ambiguous = false;
+    for (uint8_t g = 0; g < n_groups; ++g) {
+        int8_t i = cmd_lookup(s, groups[g].table[0].name,
+                sizeof(struct cmd), groups[g].n);
+        if (i == CMD_AMBIGUOUS) {
+            *ambiguous = true;
+        } else if (i >= 0) {
+            struct cmd const * c = &groups[g].table[i];
+            if (compare(s, c->name) == MATCH_EXACT) {
+                *ambiguous = false;
+                return c;
+            }
+            *ambiguous = *ambiguous || found;
+            found = c;
+        }
+    }
+    return *ambiguous ? NULL : found;
+}
+
+static void print_usage(struct cmd const * cmd)
+{
+    print_P(PSTR("%s"), cmd->name);
+    if (pgm_read_byte(cmd->usage)) {
+        print_P(PSTR(" %S"), cmd->usage);
+    }
+    print_P(PSTR("\n"));
+}
+
+void cmd_dispatch(int argc, char ** argv)
+{
+    bool ambiguous;
+    struct cmd const * c = find(argv[0], &ambiguous);
+    if (!c) {
+        if (ambiguous) {
+            print_P(PSTR("ambiguous command: %s\n"), argv[0]);
+        } else {
+            print_P(PSTR("unrecognized command: %s\n"), argv[0]);
+        }
+        return;
+    }
+
+    struct cmd cmd;
+    memcpy_P(&cmd, c, sizeof(cmd));
+    uint8_t nargs = argc - 1;
+    if (nargs < cmd.min_args || nargs > cmd.max_args) {
+        print_P(PSTR("usage: "));
+        print_usage(&cmd);
+        return;
+    }
+    cmd.run(argc, argv);
+}
+
+void cmd_help(void)
+{
+    for (uint8_t g = 0; g < n_groups; ++g) {
+        for (uint8_t i = 0; i < groups[g].n; ++i) {
+            struct cmd cmd;
+            memcpy_P(&cmd, &groups[g].table[i], sizeof(cmd));
+            print_usage(&cmd);
+        }
+    }
+}
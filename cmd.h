@@ -0,0 +1,74 @@
+#ifndef CMD_H
+#define CMD_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+// Shell commands. Each module can keep a table of its commands in flash and
+// register it with cmd_register(); cmd_dispatch() then finds a command by
+// name across every registered table and checks its argument count, and
+// cmd_help() lists them all. A command can be abbreviated to any prefix that
+// matches no other command, and case is ignored.
+//
+// A table is defined from a list macro of X(name, run, min_args, max_args,
+// usage), so that each usage string gets its own place in flash; see
+// COMMANDS in main.c:
+//
+//     #define MY_COMMANDS(X) X(foo, &foo, 1, 2, "SUPPLY [ARG]")
+//     CMD_TABLE(my_commands, MY_COMMANDS);
+//     ...
+//     cmd_register(my_commands, sizeof(my_commands) / sizeof(my_commands[0]));
+
+#define CMD_NAME_LEN    10
+#define CMD_ANY_ARGS    UINT8_MAX
+
+// Results of cmd_lookup() that are not an index
+#define CMD_NONE        (-1)
+#define CMD_AMBIGUOUS   (-2)
+
+struct cmd {
+    char name[CMD_NAME_LEN];
+    void (* run)(int argc, char ** argv);   // argv[0] is the name as typed
+    uint8_t min_args;           // not counting the name
+    uint8_t max_args;           // or CMD_ANY_ARGS
+    PGM_P usage;                // arguments, for help
+};
+
+#define CMD__USAGE(name, run, min_args, max_args, usage) \
+    _Static_assert(sizeof(#name) <= CMD_NAME_LEN, "command name: " #name); \
+    static char const cmd_usage_ ## name[] PROGMEM = usage;
+#define CMD__ENTRY(name, run, min_args, max_args, usage) \
+    { #name, run, min_args, max_args, cmd_usage_ ## name },
+#define CMD_TABLE(table, LIST) \
+    LIST(CMD__USAGE) \
+    static struct cmd const table[] PROGMEM = { LIST(CMD__ENTRY) }
+
+/**
+ * Add a table of commands. Names should be unique across all tables.
+ *
+ * @param table - table of commands in flash
+ * @param n - number of commands
+ * @return true if CMD_MAX_GROUPS tables are already registered
+ */
+bool cmd_register(struct cmd const * table, uint8_t n);
+
+// Run the command named by argv[0], or complain about it.
+void cmd_dispatch(int argc, char ** argv);
+
+// Print the usage of every command.
+void cmd_help(void);
+
+/**
+ * Find a name in a table in flash, by exact match or else by unique prefix,
+ * ignoring case.
+ *
+ * @param s - name to find
+ * @param names - first name in the table, NUL-terminated
+ * @param stride - bytes from one name to the next
+ * @param n - number of names
+ * @return index of the name, CMD_NONE or CMD_AMBIGUOUS
+ */
+int8_t cmd_lookup(char const * s, PGM_P names, uint8_t stride, uint8_t n);
+
+#endif // CMD_H
@@ -0,0 +1,43 @@
+#include "eeprom.h"
+#include "hardware.h"
+
+bool ee_busy(void)
+{
+    return NVM.STATUS & NVM_NVMBUSY_bm;
+}
+
+static void nvm_exec(uint8_t cmd)
+{
+    NVM.CMD = cmd;
+    _PROTECTED_WRITE(NVM.CTRLA, NVM_CMDEX_bm);
+    NVM.CMD = NVM_CMD_NO_OPERATION_gc;
+}
+
+void ee_write(uint16_t addr, void const * src, uint8_t n)
+{
+    if (NVM.STATUS & NVM_EELOAD_bm) {
+        nvm_exec(NVM_CMD_ERASE_EEPROM_BUFFER_gc);
+        while (ee_busy());
+    }
+
+    uint8_t volatile * dest = (uint8_t volatile *) (MAPPED_EEPROM_START + addr);
+    NVM.CMD = NVM_CMD_LOAD_EEPROM_BUFFER_gc;
+    for (uint8_t i = 0; i < n; ++i) {
+        dest[i] = ((uint8_t const *) src)[i];
+    }
+
+    NVM.ADDR0 = addr & 0xff;
+    NVM.ADDR1 = addr >> 8;
+    NVM.ADDR2 = 0;
+    nvm_exec(NVM_CMD_ERASE_WRITE_EEPROM_PAGE_gc);
+}
+
+void ee_read(uint16_t addr, void * dest, uint8_t n)
+{
+    while (ee_busy());
+    uint8_t const volatile * src =
+        (uint8_t const volatile *) (MAPPED_EEPROM_START + addr);
+    for (uint8_t i = 0; i < n; ++i) {
+        ((uint8_t *) dest)[i] = src[i];
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Internal EEPROM access through the memory-mapped EEPROM.
+
+// Return whether an EEPROM operation is in progress.
+bool ee_busy(void);
+
+// Erase and write up to a page of bytes, which must not cross a page
+// boundary. Only the bytes written are erased; the rest of the page is kept.
+// Returns once the write has started. Must not be called while ee_busy(); if
+// the EEPROM ready interrupt may also write, mask it (see plog_pause()) or
+// call with interrupts disabled.
+void ee_write(uint16_t addr, void const * src, uint8_t n);
+
+// Read bytes, waiting for any write in progress to finish first.
+void ee_read(uint16_t addr, void * dest, uint8_t n);
+
+#endif // EEPROM_H
@@ -0,0 +1,68 @@
+#include "evlog.h"
+#include "hardware.h"
+#include "plog.h"
+#include <util/atomic.h>
+
+_Static_assert((EVLOG_SIZE & (EVLOG_SIZE - 1)) == 0 && EVLOG_SIZE <= 128,
+        "EVLOG_SIZE must be a power of two up to 128");
+_Static_assert(sizeof(struct evlog_entry) == 6, "evlog entries must be packed");
+
+static struct evlog_entry entries[EVLOG_SIZE];
+static uint8_t head = 0;    // next to write
+static uint8_t count = 0;
+static uint8_t dropped = 0;
+
+void evlog(uint8_t type, uint8_t arg)
+{
+    uint32_t ms;
+    // Timestamp and slot together, so entries stay in time order when an
+    // interrupt logs in between
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ms = uptime_ms();
+        entries[head] = (struct evlog_entry) {
+            .ms = ms, .type = type, .arg = arg,
+        };
+        head = (head + 1) & (EVLOG_SIZE - 1);
+        if (count < EVLOG_SIZE) {
+            ++count;
+        } else if (dropped < UINT8_MAX) {
+            ++dropped;
+        }
+    }
+
+    if (plog_is_critical(type, arg)) {
+        struct evlog_entry entry = { .ms = ms, .type = type, .arg = arg };
+        plog_write(&entry);
+    }
+}
+
+bool evlog_peek(struct evlog_entry * entry)
+{
+    bool any;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        any = count;
+        if (any) {
+            *entry = entries[(head - count) & (EVLOG_SIZE - 1)];
+        }
+    }
+    return any;
+}
+
+void evlog_pop(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (count) {
+            --count;
+        }
+    }
+}
+
+uint8_t evlog_count(void)
+{
+    return count;
+}
+
+uint8_t evlog_dropped(void)
+{
+    return dropped;
+}
@@ -0,0 +1,51 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Event log. A ring buffer of EVLOG_SIZE timestamped entries in RAM, written
+// from anywhere including interrupts. When full, new events overwrite the
+// oldest and are counted as dropped.
+
+enum evlog_type {
+    EV_NONE,
+    EV_ENABLE,          // arg: supply ID
+    EV_DISABLE,         // arg: supply ID
+    EV_PG_RISE,         // arg: supply ID
+    EV_PG_FALL,         // arg: supply ID
+    EV_SUPERVISION,     // arg: supply ID << 4 | enum sup_state
+    EV_STANDBY_ENTER,
+    EV_STANDBY_EXIT,
+    EV_CMD_UART,        // arg: first character of the command
+    EV_CMD_I2C,         // arg: register address written
+    EV_RESET,           // arg: RST.STATUS
+    EV_ALARM,           // arg: alarm action
+    EV_POWER_FAIL,      // arg: cycles to cut the supplies, saturating
+    EV_WATCHDOG,        // arg: watchdog sources missing (see wdog.h)
+};
+
+struct evlog_entry {
+    uint32_t ms;        // uptime_ms()
+    uint8_t type;       // enum evlog_type
+    uint8_t arg;
+} __attribute__((packed));
+
+// Record an event. Constant time, interrupt safe. Critical events are also
+// queued for the persistent log (see plog.h).
+void evlog(uint8_t type, uint8_t arg);
+
+// Return the oldest entry without removing it.
+// @return false if the log is empty
+bool evlog_peek(struct evlog_entry * entry);
+
+// Remove the oldest entry.
+void evlog_pop(void);
+
+// Return the number of entries in the log.
+uint8_t evlog_count(void);
+
+// Return the number of entries overwritten before being read, saturating.
+uint8_t evlog_dropped(void);
+
+#endif // EVLOG_H
@@ -0,0 +1,151 @@
+#include "fmt.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+static fmt_sink console = NULL;
+
+void init_fmt(fmt_sink sink)
+{
+    console = sink;
+}
+
+static void pad(fmt_sink sink, uint8_t n, char c)
+{
+    while (n--) {
+        sink(c);
+    }
+}
+
+// Write the digits of v right-aligned ending at end, and return the first.
+// 16-bit values take the shorter division.
+static char * digits(char * end, unsigned long v, uint8_t base, bool is_long)
+{
+    char * p = end;
+    do {
+        uint8_t d;
+        if (is_long) {
+            d = v % base;
+            v /= base;
+        } else {
+            d = (unsigned) v % base;
+            v = (unsigned) v / base;
+        }
+        *--p = d < 10 ? '0' + d : 'a' + d - 10;
+    } while (v);
+    return p;
+}
+
+void vfmt_P(fmt_sink sink, PGM_P format, va_list ap)
+{
+    char c;
+    while ((c = pgm_read_byte(format++))) {
+        if (c != '%') {
+            sink(c);
+            continue;
+        }
+
+        bool left = false, zero = false, plus = false, is_long = false;
+        uint8_t width = 0;
+        c = pgm_read_byte(format++);
+        if (c == '+') {
+            plus = true;
+            c = pgm_read_byte(format++);
+        }
+        if (c == '-') {
+            left = true;
+            c = pgm_read_byte(format++);
+        } else if (c == '0') {
+            zero = true;
+            c = pgm_read_byte(format++);
+        }
+        while (c >= '0' && c <= '9') {
+            width = width * 10 + (c - '0');
+            c = pgm_read_byte(format++);
+        }
+        if (c == 'l') {
+            is_long = true;
+            c = pgm_read_byte(format++);
+        }
+
+        char buf[11];       // a 32-bit value in decimal, and its sign
+        char const * str = buf;
+        bool in_flash = false;
+        uint8_t len = 1;
+
+        switch (c) {
+        case '\0':
+            return;
+        case 'd':
+        case 'u':
+        case 'x': {
+            unsigned long v;
+            bool neg = false;
+            if (c == 'd') {
+                long s = is_long ? va_arg(ap, long) : va_arg(ap, int);
+                neg = s < 0;
+                v = neg ? -(unsigned long) s : (unsigned long) s;
+            } else {
+                v = is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned);
+            }
+            char * end = buf + sizeof(buf);
+            char * p = digits(end, v, c == 'x' ? 16 : 10, is_long);
+            char sign = neg ? '-' : plus && c == 'd' ? '+' : '\0';
+            if (sign) {
+                // The sign goes before any zero padding
+                if (zero) {
+                    sink(sign);
+                    width = width ? width - 1 : 0;
+                } else {
+                    *--p = sign;
+                }
+            }
+            str = p;
+            len = end - p;
+            break;
+        }
+        case 'c':
+            buf[0] = va_arg(ap, int);
+            break;
+        case 's':
+            str = va_arg(ap, char const *);
+            len = strlen(str);
+            break;
+        case 'S':
+            str = va_arg(ap, PGM_P);
+            len = strlen_P(str);
+            in_flash = true;
+            break;
+        default:
+            buf[0] = c;
+            break;
+        }
+
+        uint8_t fill = width > len ? width - len : 0;
+        if (!left) {
+            pad(sink, fill, zero ? '0' : ' ');
+        }
+        for (uint8_t i = 0; i < len; ++i) {
+            sink(in_flash ? pgm_read_byte(&str[i]) : str[i]);
+        }
+        if (left) {
+            pad(sink, fill, ' ');
+        }
+    }
+}
+
+void fmt_P(fmt_sink sink, PGM_P format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vfmt_P(sink, format, ap);
+    va_end(ap);
+}
+
+void print_P(PGM_P format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    vfmt_P(console, format, ap);
+    va_end(ap);
+}
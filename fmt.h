@@ -0,0 +1,26 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <stdarg.h>
+#include <avr/pgmspace.h>
+
+// Formatted output. A small stand-in for printf_P that covers what the shell
+// uses: %d, %u, %x, %c, %s (string in RAM), %S (string in flash) and %%, with
+// an optional '+' flag (sign on positive %d) followed by an optional '-'
+// (left-justify) or '0' (zero-pad) flag, a field width, and the 'l' modifier
+// for long arguments. Characters go straight to a sink function rather than
+// through a FILE, and avr-libc's vfprintf is not linked at all.
+
+typedef void (* fmt_sink)(char c);
+
+// Set the sink print_P() writes to.
+void init_fmt(fmt_sink sink);
+
+// Format to the sink set with init_fmt().
+void print_P(PGM_P format, ...);
+
+// Format to the given sink.
+void fmt_P(fmt_sink sink, PGM_P format, ...);
+void vfmt_P(fmt_sink sink, PGM_P format, va_list ap);
+
+#endif // FMT_H
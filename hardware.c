@@ -1,7 +1,9 @@
 #include <util/atomic.h>
+#include <avr/sleep.h>
 #include <assert.h>
 #include "hardware.h"
 #include "regulator.h"
+#include "perf.h"
 
 
 // Include bits not defined in 128A1U header (128A1U was used for devel)
@@ -38,6 +40,9 @@ _Static_assert(&TX_PORT == &RX_PORT,
         "UART must be on a single port");
 _Static_assert((TX_bp == 7 || TX_bp == 3) && (RX_bp == 6 || RX_bp == 2),
         "UART must be on a hardware USART port");
+
+_Static_assert(&DCDC_PG_PORT == &RX_PORT && &N12_PG_PORT == &RX_PORT,
+        "PG pins must share the RX pin change interrupt");
 _Static_assert(TX_bp == RX_bp + 1,
         "UART pins must be either both remapped or neither");
 
@@ -47,6 +52,11 @@ _Static_assert(&P5A_SYNC_PORT == &P5B_SYNC_PORT &&
         "DC-DC sync pins must all be on the same port");
 _Static_assert(DCDC_SYNC_gm == 0xf0 || DCDC_SYNC_gm == 0x0f,
         "DC-DC sync pins must be either all remapped or none");
+_Static_assert(!DCDC_P5_TC5 ||
+               (&P5A_SYNC_PORT == &PORTC &&
+                P5A_SYNC_bp == 4 && P5A_SYNC_CC_bp == 0 &&
+                P5B_SYNC_bp == 5 && P5B_SYNC_CC_bp == 2),
+        "TCC5 sync outputs must be on PC4 (channel A) and PC5 (channel B)");
 _Static_assert(&P5A_PG_PORT == &P5B_PG_PORT &&
                &P5A_PG_PORT == &P3A_PG_PORT &&
                &P5A_PG_PORT == &P3B_PG_PORT,
@@ -82,7 +92,7 @@ void init_ports(void)
     N12_EN_PORT.PINCTRL(N12_EN_bp) = PORT_OPC_TOTEM_gc | PORT_INVEN_bm;
     N12_EN_PORT.OUTCLR = bm(N12_EN_bp);
     N12_EN_PORT.DIRSET = bm(N12_EN_bp);
-    N12_PG_PORT.PINCTRL(N12_PG_bp) = PORT_OPC_PULLUP_gc;
+    N12_PG_PORT.PINCTRL(N12_PG_bp) = PORT_OPC_PULLUP_gc | PORT_ISC_BOTHEDGES_gc;
     N12_PG_PORT.DIRCLR = bm(N12_PG_bp);
 
     P3B_DISCH_PORT.PINCTRL(P3B_DISCH_bp) = PORT_OPC_WIREDAND_gc;
@@ -114,6 +124,8 @@ void init_ports(void)
 
 
 _Static_assert(F_CPU == 32000000uLL, "F_CPU is expected to be 32 MHz");
+// The standby tick must fit the compare step and uptime_us()'s tick period
+_Static_assert(STANDBY_TICK_MS <= 65, "STANDBY_TICK_MS out of range");
 void init_clock(void)
 {
     OSC.CTRL |= OSC_RC32MEN_bm;
@@ -157,6 +169,14 @@ void disable_n12(void)
 
 static volatile bool standby_flag = false;
 
+// Tick period in timer cycles and in ms. The peripheral clock is cut by 256 in
+// standby, where the tick is also slowed down to keep its overhead low.
+static volatile uint16_t tick_cycles = TICK_CYCLES;
+static volatile uint8_t tick_step_ms = 1;
+// Time of the last tick in us, and the tick timer count it was due at
+static volatile uint32_t tick_us = 0;
+static volatile uint16_t tick_cnt = 0;
+
 void standby(void)
 {
     reg_disable(reg_N12);
@@ -171,18 +191,53 @@ void standby(void)
     _PROTECTED_WRITE(CLK.PSCTRL, CLK_PSADIV_16_gc | CLK_PSBCDIV_1_1_gc);
     _PROTECTED_WRITE(CLK.CTRL, CLK_SCLKSEL_RC2M_gc);
     OSC.CTRL &= ~OSC_RC32MEN_bm;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        tick_cycles = TICK_CYCLES / 256 * STANDBY_TICK_MS;
+        tick_step_ms = STANDBY_TICK_MS;
+    }
     standby_flag = true;
 }
 
 
-ISR(RX_vect)
+// Leave standby. Called from interrupt context. RX only wakes from standby,
+// so its wake interrupt goes off whichever source woke the MCU.
+static void wake(void)
 {
-    RX_PORT.INTCTRL = PORT_INTLVL_OFF_gc;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        RX_PORT.INTMASK &= ~bm(RX_bp);
+    }
     init_clock();
+    tick_cycles = TICK_CYCLES;
+    tick_step_ms = 1;
     standby_flag = false;
 }
 
 
+static void (* volatile pin_change_callback)(uint8_t pins, uint32_t us) = NULL;
+
+void init_pin_change(void (* callback)(uint8_t pins, uint32_t us))
+{
+    pin_change_callback = callback;
+    RX_PORT.INTFLAGS = PG_gm;
+    RX_PORT.INTMASK |= PG_gm;
+}
+
+// Shared by the wake-on-RX and PG edge interrupts
+ISR(RX_vect)
+{
+    uint8_t flags = RX_PORT.INTFLAGS & RX_PORT.INTMASK;
+    RX_PORT.INTFLAGS = flags;
+
+    if ((flags & PG_gm) && pin_change_callback) {
+        pin_change_callback(flags & PG_gm, uptime_us());
+    }
+
+    if (flags & bm(RX_bp)) {
+        wake();
+    }
+}
+
+
 bool in_standby(void)
 {
     return standby_flag;
@@ -191,8 +246,19 @@ bool in_standby(void)
 
 void enable_wake(void)
 {
-    RX_PORT.INTFLAGS = bm(RX_bp);
-    RX_PORT.INTCTRL = PORT_INTLVL_LO_gc;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (standby_flag && !(RX_PORT.INTMASK & bm(RX_bp))) {
+            RX_PORT.INTFLAGS = bm(RX_bp);
+            RX_PORT.INTMASK |= bm(RX_bp);
+        }
+    }
+}
+
+
+void idle(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
 }
 
 
@@ -202,7 +268,7 @@ void enable_wake(void)
 
 void init_uart(void)
 {
-    UART_USART.CTRLA = 0;
+    UART_USART.CTRLA = USART_RXCINTLVL_LO_gc;
     UART_USART.CTRLB = USART_TXEN_bm | USART_RXEN_bm
         | (UART_2X ? USART_CLK2X_bm : 0);
     UART_USART.CTRLC = 0
@@ -220,18 +286,42 @@ void init_uart(void)
 }
 
 
+bool uart_tx_ready(void)
+{
+    return UART_USART.STATUS & USART_DREIF_bm;
+}
+
 void uart_transmit(char ch)
 {
     while (!(UART_USART.STATUS & USART_DREIF_bm));
     UART_USART.DATA = ch;
 }
 
+static volatile uint8_t rx_buf[UART_RX_BUF];
+static volatile uint8_t rx_head = 0, rx_tail = 0;
+_Static_assert((UART_RX_BUF & (UART_RX_BUF - 1)) == 0,
+        "UART_RX_BUF must be a power of two");
+
 int uart_receive(void)
 {
-    if (UART_USART.STATUS & USART_RXCIF_bm) {
-        return (int)(unsigned char) UART_USART.DATA;
-    } else {
-        return -1;
+    int c = -1;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (rx_head != rx_tail) {
+            c = rx_buf[rx_tail];
+            rx_tail = (rx_tail + 1) & (UART_RX_BUF - 1);
+        }
+    }
+    return c;
+}
+
+ISR(UART_RXC_vect)
+{
+    uint8_t c = UART_USART.DATA;
+    uint8_t next = (rx_head + 1) & (UART_RX_BUF - 1);
+    // When full, drop the character
+    if (next != rx_tail) {
+        rx_buf[rx_head] = c;
+        rx_head = next;
     }
 }
 
@@ -252,5 +342,321 @@ void init_twi(void (* callback)(TWI_Slave_t * packet))
 
 ISR(I2C_VECT)
 {
+    uint32_t start = perf_now();
     TWI_SlaveInterruptHandler(&twi_slave);
+    perf_record(PERF_TWI_ISR, start);
+}
+
+
+/******************************************************************************
+ * Timebase
+ *****************************************************************************/
+
+// The RTC counts the 32.768 kHz internal oscillator, which runs regardless of
+// the system clock, and overflows every two seconds.
+static volatile uint32_t rtc_ovf = 0;
+
+void init_timebase(void)
+{
+    OSC.CTRL |= OSC_RC32KEN_bm;
+    while (!(OSC.STATUS & OSC_RC32KRDY_bm));
+    CLK.RTCCTRL = CLK_RTCSRC_RCOSC32_gc | CLK_RTCEN_bm;
+
+    // Writes cross into the RTC clock domain one at a time
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.PER = 0xffff;
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.CNT = 0;
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc;
+}
+
+// Read the overflow count and counter consistently.
+static void rtc_read(uint32_t * ovf, uint16_t * cnt)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *cnt = RTC.CNT;
+        *ovf = rtc_ovf;
+        if (RTC.INTFLAGS & RTC_OVFIF_bm) {
+            // Overflowed but not yet serviced. The count may have been read
+            // before or after, so read it again.
+            *cnt = RTC.CNT;
+            ++*ovf;
+        }
+    }
+}
+
+uint32_t uptime_ms(void)
+{
+    uint32_t ovf;
+    uint16_t cnt;
+    rtc_read(&ovf, &cnt);
+    return ovf * 2000 + (((uint32_t) cnt * 1000) >> 15);
+}
+
+// Timer cycles per us at full speed. The peripheral clock is cut by 256 in
+// standby.
+#define TICK_CYCLES_US  ((uint16_t) (F_CPU / 1000000))
+
+uint32_t uptime_us(void)
+{
+    uint32_t us;
+    uint16_t cycles;
+    uint16_t period_us;
+    bool slow;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        us = tick_us;
+        cycles = TICK_TIMER.CNT - tick_cnt;
+        period_us = tick_step_ms * 1000u;
+        slow = standby_flag;
+    }
+    uint32_t since = slow
+        ? (uint32_t) cycles * (256 / TICK_CYCLES_US)
+        : cycles / TICK_CYCLES_US;
+    // A pending tick, or the first one after a clock change, can run past
+    // the period; holding at its end keeps the count monotonic.
+    return us + (since < period_us ? since : period_us);
+}
+
+/******************************************************************************
+ * Alarm
+ *****************************************************************************/
+
+// The alarm time is kept as an RTC overflow count and counter value. The
+// compare interrupt is armed once the alarm falls within the current RTC
+// period.
+static volatile bool alarm_armed = false;
+static volatile bool alarm_fired = false;
+static uint32_t alarm_ovf;
+static uint16_t alarm_cnt;
+
+// Called with interrupts disabled
+static void alarm_fire(void)
+{
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc;
+    alarm_armed = false;
+    alarm_fired = true;
+    if (standby_flag) {
+        wake();
+    }
+}
+
+// Called with interrupts disabled
+static void alarm_arm_compare(void)
+{
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.COMP = alarm_cnt;
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.INTFLAGS = RTC_COMPIF_bm;
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc | RTC_COMPINTLVL_LO_gc;
+    // A compare value the counter has already reached, like 0 right after
+    // the overflow, would not match until the next period, 2 s late. Firing
+    // here also turns off the compare interrupt, in case it matched as well.
+    if (RTC.CNT >= alarm_cnt) {
+        alarm_fire();
+    }
+}
+
+void alarm_set(uint16_t seconds)
+{
+    uint32_t ovf;
+    uint16_t cnt;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        RTC.INTCTRL = RTC_OVFINTLVL_LO_gc;
+        alarm_armed = false;
+
+        if (seconds) {
+            rtc_read(&ovf, &cnt);
+            // Two seconds per overflow, half an overflow per odd second
+            alarm_ovf = ovf + seconds / 2;
+            alarm_cnt = cnt + (seconds & 1 ? 0x8000 : 0);
+            if (alarm_cnt < cnt) {
+                ++alarm_ovf;
+            }
+            alarm_armed = true;
+            if (alarm_ovf == ovf) {
+                alarm_arm_compare();
+            }
+        }
+    }
+}
+
+uint32_t alarm_remaining_ms(void)
+{
+    uint32_t ovf;
+    uint16_t cnt;
+    bool armed;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        rtc_read(&ovf, &cnt);
+        armed = alarm_armed;
+    }
+    if (!armed) {
+        return 0;
+    }
+    int32_t ticks = (int32_t) ((alarm_ovf - ovf) << 16) + alarm_cnt - cnt;
+    if (ticks <= 0) {
+        return 0;
+    }
+    return ((uint32_t) ticks >> 15) * 1000 +
+        ((((uint32_t) ticks & 0x7fff) * 1000) >> 15);
+}
+
+bool alarm_take(void)
+{
+    bool fired;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        fired = alarm_fired;
+        alarm_fired = false;
+    }
+    return fired;
+}
+
+ISR(RTC_OVF_vect)
+{
+    ++rtc_ovf;
+    if (alarm_armed && rtc_ovf == alarm_ovf) {
+        alarm_arm_compare();
+    }
+}
+
+ISR(RTC_COMP_vect)
+{
+    alarm_fire();
+}
+
+
+/******************************************************************************
+ * Power fail
+ *****************************************************************************/
+
+_Static_assert(PFAIL_MV > 3000 && PFAIL_MV < RAMP_VCC_MIN_MV,
+        "PFAIL_MV must be between the BOD level and RAMP_VCC_MIN_MV");
+
+static volatile bool pfail_flag = false;
+static volatile bool pfail_latched = false;
+static volatile uint16_t pfail_cycles;
+static volatile uint16_t pfail_count = 0;
+
+void init_power_fail(void)
+{
+    DACA.CTRLC = DAC_REFSEL_INT1V_gc;
+    DACA.CTRLB = DAC_CHSEL_SINGLE_gc;
+    DACA.CTRLA = DAC_IDOEN_bm | DAC_ENABLE_bm;
+    DACA.CH0DATA = PFAIL_DAC_DATA;
+
+    ACA.CTRLB = PFAIL_SCALEFAC;
+    ACA.AC0MUXCTRL = AC_MUXPOS_DAC_gc | AC_MUXNEG_SCALER_gc;
+    ACA.AC0CTRL = AC_INTMODE_RISING_gc | AC_INTLVL_HI_gc | AC_HSMODE_bm |
+        AC_HYSMODE_SMALL_gc | AC_ENABLE_bm;
+    ACA.STATUS = AC_AC0IF_bm;
+}
+
+bool power_fail_take(uint16_t * cycles)
+{
+    bool failed;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        failed = pfail_flag;
+        pfail_flag = false;
+        *cycles = pfail_cycles;
+    }
+    return failed;
+}
+
+bool power_fail_latched(void)
+{
+    return pfail_latched;
+}
+
+void power_fail_release(void)
+{
+    pfail_latched = false;
+}
+
+uint16_t power_fail_count(void)
+{
+    uint16_t n;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        n = pfail_count;
+    }
+    return n;
+}
+
+void set_int(bool asserted)
+{
+    if (asserted) {
+        INT_PORT.OUTSET = bm(INT_bp);
+        INT_PORT.DIRSET = bm(INT_bp);
+    } else {
+        INT_PORT.OUTCLR = bm(INT_bp);
+    }
+}
+
+// Every write below is to a constant address, and nothing is called, so the
+// prologue stays short. Reaction time is the comparator's propagation delay,
+// up to 5 cycles to finish the current instruction and enter the vector, the
+// prologue, and the cycles measured here; interrupts held off by an ATOMIC_BLOCK
+// delay it further.
+ISR(PFAIL_VECT)
+{
+    uint16_t start = TICK_TIMER.CNT;
+
+    N12_EN_PORT.OUTCLR = bm(N12_EN_bp);
+
+    // Releasing a SYNC pin to its pull-down overrides the timer waveform in
+    // both PWM and frequency mode
+    PORTCFG.MPCMASK = PFAIL_P5_gm;
+    DCDC_SYNC_PORT.PIN0CTRL = PORT_OPC_PULLDOWN_gc;
+    DCDC_SYNC_PORT.DIRCLR = PFAIL_P5_gm;
+
+    PORTCFG.MPCMASK = PFAIL_P3_gm;
+    DCDC_SYNC_PORT.PIN0CTRL = PORT_OPC_PULLDOWN_gc;
+    DCDC_SYNC_PORT.DIRCLR = PFAIL_P3_gm;
+
+    pfail_cycles = TICK_TIMER.CNT - start;
+
+    INT_PORT.OUTSET = bm(INT_bp);
+    INT_PORT.DIRSET = bm(INT_bp);
+    ++pfail_count;
+    pfail_flag = true;
+    pfail_latched = true;
+    if (standby_flag) {
+        wake();
+    }
+}
+
+
+/******************************************************************************
+ * Tick timer
+ *****************************************************************************/
+
+static void (* volatile tick_callback)(void) = NULL;
+
+void init_tick(void (* callback)(void))
+{
+    tick_callback = callback;
+    TICK_TIMER.CTRLA = TC45_CLKSEL_DIV1_gc;
+    TICK_TIMER.CCA = TICK_CYCLES;
+    TICK_TIMER.CTRLE = TC45_CCAMODE_COMP_gc;
+    TICK_TIMER.INTCTRLB = TC45_CCAINTLVL_LO_gc;
+}
+
+uint8_t tick_period_ms(void)
+{
+    return tick_step_ms;
+}
+
+ISR(TICK_vect)
+{
+    // The timer free-runs, so advancing the compare value keeps the tick
+    // period exact regardless of interrupt latency
+    tick_cnt = TICK_TIMER.CCA;
+    tick_us += tick_step_ms * 1000u;
+    TICK_TIMER.CCA += tick_cycles;
+    TICK_TIMER.INTFLAGS = TC5_CCAIF_bm;
+    if (tick_callback) {
+        uint32_t start = perf_now();
+        tick_callback();
+        perf_record(PERF_TICK_ISR, start);
+    }
 }
@@ -23,6 +23,8 @@
 #define LED_C_PORT  PORTA
 #define LED_C_bp    3
 #define LED_gm      (bm(LED_A_bp) | bm(LED_B_bp) | bm(LED_C_bp))
+// Extra ticks each position of the LED matrix is held lit for
+#define LED_HOLD_TICKS  0
 
 #define SDA_PORT    PORTC
 #define SDA_bp      0
@@ -51,15 +53,114 @@
 #define UART_PARITY 'N'
 #define UART_STOP   1
 #define UART_DREINTLVL  USART_DREINTLVL_LO_gc
+#define UART_RXC_vect   USARTD0_RXC_vect
+// Receive buffer size, a power of two
+#define UART_RX_BUF     16
 
 #define N12_EN_PORT PORTA
 #define N12_EN_bp   0
 #define N12_PG_PORT PORTD
 #define N12_PG_bp   0
+// Delay from N12's parent supplies being good until it is enabled
+#define N12_DELAY_MS    100
+
+// Supervision. PG must come up within SUP_SETTLE_MS of enabling a supply and
+// then stay good that long again before the supply counts as settled. Faulted
+// supplies are retried up to SUP_RETRY_LIMIT times in a row (settable per
+// supply), with off-times doubling from SUP_RETRY_OFF_MS to SUP_RETRY_MAX_MS.
+#define SUP_SETTLE_MS       100
+#define SUP_RETRY_LIMIT     3
+#define SUP_RETRY_OFF_MS    10
+#define SUP_RETRY_MAX_MS    1000
+// PG deglitch filter default, in tick samples (see supervisor.h)
+#define SUP_DEGLITCH_SAMPLES    3
+
+// ADC. Conversions run at F_CPU / 256 = 125 kHz.
+#define ADC_ADC         ADCA
+#define ADC_PRESCALER   ADC_PRESCALER_DIV256_gc
+// Background conversions start on each tick through event channel ADC_EVCH,
+// averaging 16 samples each.
+#define ADC_EVCH        2
+#define ADC_EVSRC       EVSYS_CHMUX_TCD5_CCA_gc
+#define ADC_AVGCTRL     (ADC_SAMPNUM_16X_gc | (4 << ADC_CH_RIGHTSHIFT_gp))
+// Typical reading of 0 V in unsigned mode, used to convert the production
+// calibration values
+#define ADC_UNSIGNED_OFFSET 200
+
+// Start-up dwell: regulators are brought up once VCC has been at least
+// RAMP_VCC_MIN_MV for RAMP_DWELL_MS, or after RAMP_MAX_MS regardless, the
+// fixed delay this replaced. This is only a VCC stability check. VCC is the
+// MCU rail, already in regulation when the code runs, and the input rail is
+// not wired to the ADC, so its ramp is not measured.
+#define RAMP_VCC_MIN_MV 3200
+#define RAMP_DWELL_MS   20
+#define RAMP_MAX_MS     40
+
+// Power-fail warning. Analog comparator PFAIL_AC trips when VCC falls below
+// PFAIL_MV: its negative input is VCC * (PFAIL_SCALEFAC + 1) / 64 and its
+// positive input is the DAC, held at the same fraction of PFAIL_MV. This
+// must sit between the 3.0V BOD level (see the fuses target in the Makefile)
+// and RAMP_VCC_MIN_MV, so the warning comes before the reset. It is centred
+// in the 3.0-3.2V window: the VCC regulator's 3% tolerance puts VCC at
+// 3.2V or above, and the reference, scaler and comparator offset together
+// move the trip point by up to about 2% (60 mV).
+#define PFAIL_MV        3100
+#define PFAIL_SCALEFAC  15
+#define PFAIL_DAC_DATA  \
+    ((uint16_t) ((uint32_t) PFAIL_MV * (PFAIL_SCALEFAC + 1) * 4095 / 64 / 1000))
+#define PFAIL_VECT      ACA_AC0_vect
+// SYNC pins of the 5V and 3.3V pairs, released in that order on power fail
+#define PFAIL_P5_gm     (bm(P5A_SYNC_bp) | bm(P5B_SYNC_bp))
+#define PFAIL_P3_gm     (bm(P3A_SYNC_bp) | bm(P3B_SYNC_bp))
+
+// Cycle profiler (see perf.h). When 0, the instrumentation compiles out.
+#define PERF            1
+#define PERF_TIMER      TICK_TIMER
+#define PERF_OVF_vect   TCD5_OVF_vect
+
+// Interval between scans for the stack high-water mark (see mem.h)
+#define MEM_CHECK_MS    1000
+
+// Watchdog (see wdog.h). The WDT runs from the 1 kHz ULP oscillator, which is
+// only accurate to some tens of percent, so it is fed no earlier than
+// WDOG_OPEN_MS, well clear of both ends of the window.
+#define WDOG_PER        WDT_PER_256CLK_gc
+#define WDOG_WPER       WDT_WPER_32CLK_gc
+#define WDOG_TIMEOUT_MS 256
+#define WDOG_CLOSED_MS  32
+#define WDOG_OPEN_MS    64
+
+// Formatted output goes through print_P (see fmt.h). When 1, avr-libc's
+// vfprintf is linked as well, and 'bench' compares the two on a 'stat' line.
+// Building with this at 0 and 1 gives the flash saved.
+#define FMT_BENCH       0
+
+// Maximum number of scheduler tasks (see sched.h)
+#define SCHED_MAX_TASKS 12
+
+// Maximum number of shell command tables (see cmd.h)
+#define CMD_MAX_GROUPS  4
+
+// Event log size in entries, a power of two. Entries are 6 bytes.
+#define EVLOG_SIZE      32
+
+// Persistent event log in EEPROM: byte offset and size (whole pages), and
+// the number of records that may wait to be written.
+#define PLOG_START      0
+#define PLOG_SIZE       512
+#define PLOG_QUEUE      4
+
+// Power-on profile in EEPROM, after the persistent log
+#define PROFILE_START   (PLOG_START + PLOG_SIZE)
+
+// When 1, the reg_id_* status accessors test the supplies' pins and state
+// directly rather than calling through the regulator vtables.
+#define REG_STATIC_DISPATCH 1
 
 #define P5A_SYNC_PORT   PORTC
 #define P5A_SYNC_bp     4
 #define P5A_SYNC_CC_bp  0   // A
+#define P5A_SYNC_TIMER  DCDC_P5_TIMER
 #define P5A_PG_PORT     PORTD
 #define P5A_PG_bp       4
 #define P5A_PHASE_180   0
@@ -67,6 +168,7 @@
 #define P5B_SYNC_PORT   PORTC
 #define P5B_SYNC_bp     5
 #define P5B_SYNC_CC_bp  2   // B
+#define P5B_SYNC_TIMER  DCDC_P5_TIMER
 #define P5B_PG_PORT     PORTD
 #define P5B_PG_bp       3
 #define P5B_PHASE_180   1
@@ -74,6 +176,7 @@
 #define P3A_SYNC_PORT   PORTC
 #define P3A_SYNC_bp     6
 #define P3A_SYNC_CC_bp  4   // C
+#define P3A_SYNC_TIMER  DCDC_TIMER
 #define P3A_PG_PORT     PORTD
 #define P3A_PG_bp       2
 #define P3A_PHASE_180   1
@@ -81,6 +184,7 @@
 #define P3B_SYNC_PORT   PORTC
 #define P3B_SYNC_bp     7
 #define P3B_SYNC_CC_bp  6   // D
+#define P3B_SYNC_TIMER  DCDC_TIMER
 #define P3B_PG_PORT     PORTD
 #define P3B_PG_bp       1
 #define P3B_PHASE_180   0
@@ -88,13 +192,90 @@
 #define P3B_DISCH_PORT  PORTA
 #define P3B_DISCH_bp    6
 
+// Default phase of each SYNC output's rising edge, in 1/256 of a period.
+// Anything other than 0 or 180 degrees needs DCDC_PWM.
+#define P5A_PHASE       (P5A_PHASE_180 ? 128 : 0)
+#define P5B_PHASE       (P5B_PHASE_180 ? 128 : 0)
+#define P3A_PHASE       (P3A_PHASE_180 ? 128 : 0)
+#define P3B_PHASE       (P3B_PHASE_180 ? 128 : 0)
+
+// Default width of each SYNC pulse at phase 0, and the range of widths each
+// converter's sync input accepts, in 1/256 of a period. PWM mode only.
+#define DCDC_DUTY       128
+#define DCDC_DUTY_MIN   26
+#define DCDC_DUTY_MAX   230
+#define P5A_DUTY_MIN    DCDC_DUTY_MIN
+#define P5A_DUTY_MAX    DCDC_DUTY_MAX
+#define P5B_DUTY_MIN    DCDC_DUTY_MIN
+#define P5B_DUTY_MAX    DCDC_DUTY_MAX
+#define P3A_DUTY_MIN    DCDC_DUTY_MIN
+#define P3A_DUTY_MAX    DCDC_DUTY_MAX
+#define P3B_DUTY_MIN    DCDC_DUTY_MIN
+#define P3B_DUTY_MAX    DCDC_DUTY_MAX
+
+// Default soft-start time of each buck in ms, 0 for none
+#define P5A_SOFTSTART_MS    0
+#define P5B_SOFTSTART_MS    0
+#define P3A_SOFTSTART_MS    0
+#define P3B_SOFTSTART_MS    0
+
 #define DCDC_SYNC_gm    (bm(P3A_SYNC_bp) | bm(P3B_SYNC_bp) | bm(P5A_SYNC_bp) | bm(P5B_SYNC_bp))
 #define DCDC_PG_gm      (bm(P3A_PG_bp) | bm(P3B_PG_bp) | bm(P5A_PG_bp) | bm(P5B_PG_bp))
 #define DCDC_FREQUENCY  600e3
 #define DCDC_SYNC_PORT  P5A_SYNC_PORT
 #define DCDC_PG_PORT    P5A_PG_PORT
+#define PG_gm           (DCDC_PG_gm | bm(N12_PG_bp))
 #define DCDC_TIMER      TCC4
 
+// Sync waveform generation. When 0, DCDC_TIMER runs in frequency mode and each
+// SYNC output is a square wave at either 0 or 180 degrees. When 1, it runs as
+// a single-slope PWM and each compare channel places its output's rising edge
+// at an arbitrary phase, allowing e.g. 0/90/180/270 degree interleaving.
+#define DCDC_PWM        1
+
+// Range of sync frequencies accepted at runtime
+#define DCDC_FREQUENCY_MIN  300e3
+#define DCDC_FREQUENCY_MAX  1000e3
+
+// Sync frequency a soft-start ramp begins at
+#define DCDC_SS_FREQUENCY   DCDC_FREQUENCY_MIN
+
+// When 1, the 5V pair is synchronized from TCC5 instead of DCDC_TIMER, so the
+// 3.3V and 5V converters can run at different frequencies. TCC5's compare
+// outputs A and B are on Px4 and Px5. Phases of P5A/P5B are then relative to
+// TCC5 rather than to the 3.3V rails.
+#define DCDC_P5_TC5     0
+#define DCDC_P5_FREQUENCY   600e3
+#if DCDC_P5_TC5
+#define DCDC_P5_TIMER   TCC5
+#else
+#define DCDC_P5_TIMER   DCDC_TIMER
+#endif
+
+// Millisecond tick. TICK_TIMER free-runs at the peripheral clock and compare
+// channel A fires every TICK_CYCLES.
+#define TICK_TIMER      TCD5
+#define TICK_vect       TCD5_CCA_vect
+#define TICK_CYCLES     ((uint16_t) (F_CPU / 1000))
+// Tick period in standby, in ms. The CPU runs at 125 kHz there, so a tick
+// gets 125 cycles per ms. The tick interrupt and a scheduler pass with the
+// supply monitor come to a few thousand cycles, which a 10 ms tick (1250
+// cycles) could not keep up with; at 50 ms the CPU sleeps for most of it.
+#define STANDBY_TICK_MS 50
+
+// Sync self-test. Capture channel B of BIST_TIMER (the free-running tick
+// timer) takes events from event channel BIST_EVCH, which is switched between
+// the SYNC pins and the sync timers' overflow. Measured edges are corrected by
+// the pin input synchronizer delay, BIST_PIN_DELAY cycles; errors above
+// BIST_TOLERANCE cycles fail the test. A capture gives up after
+// BIST_TIMEOUT_PERIODS expected sync periods without an edge.
+#define BIST_TIMER      TICK_TIMER
+#define BIST_EVCH       1
+#define BIST_PIN_DELAY  2
+#define BIST_TOLERANCE  3
+#define BIST_TIMEOUT_PERIODS    3
+#define BIST_INTERVAL_MS    1000
+
 void init_ports(void);
 void init_clock(void);
 
@@ -107,26 +288,128 @@ void init_uart(void);
  */
 void uart_transmit(char ch);
 
+// Return whether uart_transmit() would not wait.
+bool uart_tx_ready(void);
+
 /**
  * Receive one character through the UART. Returns -1 if one is
- * not available.
+ * not available. Characters are buffered by the receive interrupt, which
+ * also wakes the CPU from idle().
  */
 int uart_receive(void);
 
 void init_twi(void (* callback)(TWI_Slave_t * packet));
 
+/**
+ * Start the RTC timebase behind uptime_ms(). It keeps counting through
+ * standby.
+ */
+void init_timebase(void);
+
+/**
+ * Start the tick timer.
+ *
+ * @param callback - called from interrupt context on every tick, nominally
+ *  each millisecond. In standby the tick slows to every STANDBY_TICK_MS.
+ */
+void init_tick(void (* callback)(void));
+
+/**
+ * Return milliseconds since init_timebase(). Interrupt safe.
+ */
+uint32_t uptime_ms(void);
+
+/**
+ * Return the current tick period in ms: 1, or STANDBY_TICK_MS in standby.
+ */
+uint8_t tick_period_ms(void);
+
+/**
+ * Return microseconds since init_tick(), wrapping after about 71 minutes.
+ * The tick interrupt counts whole tick periods and the tick timer fills in
+ * the rest, so the resolution is 1 us, or 8 us in standby. This follows the
+ * 32 MHz oscillator rather than the RTC, so it can drift from uptime_ms() by
+ * their mismatch; use it for intervals. Interrupt safe.
+ */
+uint32_t uptime_us(void);
+
+/**
+ * Enable the interrupt on PG pin edges.
+ *
+ * @param callback - called from interrupt context with the PG pins that saw
+ *  an edge, and the time of the interrupt from uptime_us(). Pin sense is set
+ *  with each pin's ISC.
+ */
+void init_pin_change(void (* callback)(uint8_t pins, uint32_t us));
+
 // Enter standby mode.
 // This enables 3VB in unsync mode, disables all other supplies, and decreases
 // the clock speed significantly.
 void standby(void);
 
 // Return whether in standby mode.
-// The main loop should check this after handling commands, and if we're
-// supposed to be in standby mode, wait at least a couple times the interface
-// baud rate before calling enable_wake() to avoid immediate wakeup.
+// Once in standby mode, wait at least a couple times the interface baud rate
+// before calling enable_wake() to avoid immediate wakeup.
 bool in_standby(void);
 
-// Enable the interrupts to resume from standby.
+// Enable the interrupts to resume from standby. Leaving standby disables
+// them again.
 void enable_wake(void);
 
+// Sleep until the next interrupt.
+void idle(void);
+
+/**
+ * Set the alarm to fire after the given time, replacing any pending alarm.
+ * The alarm wakes the card from standby.
+ *
+ * @param seconds - time from now, 0 to cancel
+ */
+void alarm_set(uint16_t seconds);
+
+/**
+ * Return the time left until the alarm in ms, or 0 if none is set.
+ */
+uint32_t alarm_remaining_ms(void);
+
+/**
+ * Return true, once, after the alarm has fired.
+ */
+bool alarm_take(void);
+
+/**
+ * Enable the power-fail interrupt. When VCC drops below PFAIL_MV, the
+ * interrupt cuts N12, then the 5V pair, then the 3.3V pair by writing their
+ * pins directly, and asserts INT. Regulator state is left for the main loop
+ * to update: see power_fail_take(). A released SYNC pin is held low by its
+ * pull-down until reg_buck_reattach().
+ */
+void init_power_fail(void);
+
+/**
+ * Return true, once, after a power fail.
+ *
+ * @param cycles - receives the cycles from the interrupt's first instruction
+ *  to the last supply cut
+ */
+bool power_fail_take(uint16_t * cycles);
+
+/**
+ * Return whether a power fail has cut the supplies and the main loop has not
+ * yet released them with power_fail_release(). The sequencer enables
+ * nothing meanwhile, since the requests still stand until the main loop
+ * clears them. Interrupt safe.
+ */
+bool power_fail_latched(void);
+
+// Let the sequencer run again after a power fail, once the supply requests
+// are cleared.
+void power_fail_release(void);
+
+// Return the number of power fails since reset.
+uint16_t power_fail_count(void);
+
+// Assert or release INT to the EC.
+void set_int(bool asserted);
+
 #endif // HARDWARE_H
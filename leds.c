@@ -73,15 +73,31 @@ enum led_cycle_states {
 };
 
 
+// Called once per tick. Each LED position is lit for LED_HOLD_TICKS + 2
+// ticks; positions on the diagonal have no LED and are skipped.
 void led_cycle(void)
 {
     static enum led_cycle_states state = STATE_BLANK;
-    static const uint16_t hold_limit = 100u;
+    static const uint16_t hold_limit = LED_HOLD_TICKS;
     static uint16_t hold_val = 0;
     static uint8_t row = 1;
     static uint8_t col = 1;
 
     switch (state) {
+    case STATE_BLANK:
+        config_blank();
+        do {
+            ++col;
+            if (col == N_PINS + 1) {
+                ++row;
+                col = 1;
+            }
+            if (row == N_PINS + 1) {
+                row = 1;
+            }
+        } while (row == col);
+        // fall through
+
     case STATE_CONFIG:
         if (led_states[row][col]) {
             config_pos(row, col);
@@ -97,18 +113,5 @@ void led_cycle(void)
             ++hold_val;
         }
         break;
-
-    case STATE_BLANK:
-        config_blank();
-        ++col;
-        if (col == N_PINS + 1) {
-            ++row;
-            col = 1;
-        }
-        if (row == N_PINS + 1) {
-            row = 1;
-        }
-        state = STATE_CONFIG;
-        break;
     }
 }
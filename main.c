@@ -1,28 +1,39 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <util/delay.h>
 #include <util/atomic.h>
 #include <stddef.h>
 #include <avr/pgmspace.h>
 #include <esh.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "hardware.h"
 #include "regulator.h"
 #include "leds.h"
+#include "bist.h"
+#include "pgtime.h"
+#include "perf.h"
+#include "mem.h"
+#include "sched.h"
+#include "wdog.h"
+#include "fmt.h"
+#include "cmd.h"
+#include "sequencer.h"
+#include "supervisor.h"
+#include "evlog.h"
+#include "plog.h"
+#include "profile.h"
+#include "adc.h"
 
 #define CTRL_BIT_ENABLED    (1 << 0)
 #define CTRL_BIT_POWER_GOOD (1 << 1)
 #define CTRL_BIT_L_ENABLED  (1 << 2)
 #define CTRL_BIT_INVALID    (1 << 7)
-static volatile uint8_t CONTROL[6] = {
-    CTRL_BIT_INVALID,
-    0,  // P5A
-    0,  // P5B
-    0,  // P3A
-    CTRL_BIT_ENABLED,   // P3B, enabled at startup
-    0,  // N12
+// By supply number, which is the supply ID plus one
+static volatile uint8_t CONTROL[REG_N_IDS + 1] = {
+    [0] = CTRL_BIT_INVALID,
+    [REG_ID_P3B + 1] = CTRL_BIT_ENABLED,    // enabled at startup
 };
 
 // Slight hack: if this supply is shut down, delay and then turn it back on.
@@ -40,39 +51,82 @@ static int uart_putchar(char c, FILE *stream)
     if (c == '\n') {
         uart_putchar('\r', stream);
     }
+    // Output can take a while at the debug baud rate; keep supervising
+    while (!uart_tx_ready()) {
+        sched_yield();
+    }
     uart_transmit(c);
     return 0;
 }
 
+static void console_putc(char c)
+{
+    uart_putchar(c, stdout);
+}
+
 
-// Resolves a power supply to an int.
-// The power supply name is edited in place!
+// Supply names, by regulator ID
+static char const supply_names[REG_N_IDS][4] PROGMEM = {
+    [REG_ID_P5A] = "5VA",
+    [REG_ID_P5B] = "5VB",
+    [REG_ID_P3A] = "3VA",
+    [REG_ID_P3B] = "3VB",
+    [REG_ID_N12] = "N12",
+};
+
+// Resolves a power supply name, or a unique prefix of one, to an int.
 static int resolve_supply(char const * supply)
 {
-    if (!strcasecmp_P(supply, PSTR("5VA"))) {
-        return 1;
-    } else if (!strcasecmp_P(supply, PSTR("5VB"))) {
-        return 2;
-    } else if (!strcasecmp_P(supply, PSTR("3VA"))) {
-        return 3;
-    } else if (!strcasecmp_P(supply, PSTR("3VB"))) {
-        return 4;
-    } else if (!strcasecmp_P(supply, PSTR("N12"))) {
-        return 5;
-    } else {
-        return -1;
+    int8_t i = cmd_lookup(supply, supply_names[0], sizeof(supply_names[0]),
+            REG_N_IDS);
+    return i < 0 ? -1 : i + 1;
+}
+
+static PGM_P bist_status_name(uint8_t status)
+{
+    switch (status) {
+    case BIST_SKIPPED:      return PSTR("skipped");
+    case BIST_PASS:         return PSTR("pass");
+    case BIST_DRIFT:        return PSTR("DRIFT");
+    case BIST_NO_EDGE:      return PSTR("FAIL (no edge)");
+    case BIST_BAD_PERIOD:   return PSTR("FAIL (period)");
+    case BIST_BAD_PHASE:    return PSTR("FAIL (phase)");
+    default:                return PSTR("not run");
     }
 }
 
+// Supply numbers are the regulator IDs plus one
+_Static_assert(REG_ID_P5A == 0 && REG_ID_P5B == 1 && REG_ID_P3A == 2 &&
+        REG_ID_P3B == 3 && REG_ID_N12 == 4, "supply numbering");
+
 static reg_type * map_supply(int num)
 {
-    switch (num) {
-    case 1: return reg_P5A;
-    case 2: return reg_P5B;
-    case 3: return reg_P3A;
-    case 4: return reg_P3B;
-    case 5: return reg_N12;
-    default: return NULL;
+    return num > 0 ? reg_of_id(num - 1) : NULL;
+}
+
+
+// Request a supply on or off. monitor_task() passes the change on to the
+// sequencer, so requests from the shell and from I2C take the same path.
+static void request_supply(int nsupply, bool enabled)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (enabled) {
+            CONTROL[nsupply] |= CTRL_BIT_ENABLED;
+        } else {
+            CONTROL[nsupply] &= ~CTRL_BIT_ENABLED;
+        }
+    }
+}
+
+
+// Request every supply on, or every supply except the keep-alive supply off.
+// The sequencer orders the transitions.
+static void power_all(bool enabled)
+{
+    for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+        if (enabled || map_supply(nsupply) != SUPPLY_KEEP_ALIVE) {
+            request_supply(nsupply, enabled);
+        }
     }
 }
 
@@ -80,20 +134,815 @@ static reg_type * map_supply(int num)
 static void en_dis(char const * supply, bool enabled)
 {
     int nsupply = resolve_supply(supply);
-    if (nsupply > 0 && nsupply < 6) {
+    if (nsupply > 0 && nsupply <= REG_N_IDS) {
         if (enabled) {
-            printf_P(PSTR("enable supply %d\n"), nsupply);
-            reg_enable(map_supply(nsupply), true);
+            print_P(PSTR("enable supply %d\n"), nsupply);
         } else {
-            printf_P(PSTR("disable supply %d\n"), nsupply);
-            reg_disable(map_supply(nsupply));
+            print_P(PSTR("disable supply %d\n"), nsupply);
         }
+        request_supply(nsupply, enabled);
     } else {
-        printf_P(PSTR("unrecognized supply: %s\n"), supply);
+        print_P(PSTR("unrecognized supply: %s\n"), supply);
+    }
+}
+
+
+static void phase(char const * supply, char const * degrees)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg || !reg_is_buck(reg)) {
+        print_P(PSTR("unrecognized buck supply: %s\n"), supply);
+        return;
+    }
+
+    if (degrees) {
+        uint16_t deg = (atoi(degrees) % 360 + 360) % 360;
+        uint8_t turn = ((uint32_t) deg * 256 + 180) / 360;
+        if (reg_buck_set_phase(reg, turn)) {
+            print_P(PSTR("phase not supported: %s\n"), degrees);
+        }
+    }
+
+    uint8_t turn = reg_buck_get_phase(reg);
+    print_P(PSTR("phase: %u deg\n"), (unsigned) (((uint16_t) turn * 360 + 128) / 256));
+}
+
+
+static void duty(char const * supply, char const * percent)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg || !reg_is_buck(reg)) {
+        print_P(PSTR("unrecognized buck supply: %s\n"), supply);
+        return;
+    }
+
+    if (percent) {
+        uint16_t width = ((uint32_t) atoi(percent) * 256 + 50) / 100;
+        if (width > 255 || reg_buck_set_duty(reg, width)) {
+            print_P(PSTR("duty not supported: %s\n"), percent);
+        }
+    }
+
+    uint8_t width = reg_buck_get_duty(reg);
+    print_P(PSTR("duty: %u%%\n"), (unsigned) (((uint16_t) width * 100 + 128) / 256));
+}
+
+
+static void softstart(char const * supply, char const * ms)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg || !reg_is_buck(reg)) {
+        print_P(PSTR("unrecognized buck supply: %s\n"), supply);
+        return;
+    }
+
+    if (ms) {
+        int n = atoi(ms);
+        if (n < 0 || n > 255) {
+            print_P(PSTR("soft-start out of range: %s\n"), ms);
+        } else {
+            reg_buck_set_softstart(reg, n);
+        }
+    }
+
+    print_P(PSTR("soft-start: %u ms\n"), reg_buck_get_softstart(reg));
+}
+
+
+static void freq(char const * supply, char const * khz)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg || !reg_is_buck(reg)) {
+        print_P(PSTR("unrecognized buck supply: %s\n"), supply);
+        return;
+    }
+
+    if (khz) {
+        if (reg_buck_set_frequency(reg, 1000uL * (uint32_t) atol(khz))) {
+            print_P(PSTR("frequency out of range: %s\n"), khz);
+        }
+    }
+
+    print_P(PSTR("frequency: %lu kHz\n"),
+            (unsigned long) ((reg_buck_get_frequency(reg) + 500) / 1000));
+}
+
+
+static void pgtime(char const * supply, char const * action)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg) {
+        print_P(PSTR("unrecognized supply: %s\n"), supply);
+        return;
+    }
+
+    if (action && !strcmp_P(action, PSTR("clear"))) {
+        pgtime_clear(reg);
+        return;
+    }
+
+    struct pgtime_stats s = pgtime_get(reg);
+    print_P(PSTR("time to PG: %u samples  min %lu us  max %lu us  mean %lu us\n"),
+            s.count,
+            (unsigned long) s.min_us,
+            (unsigned long) s.max_us,
+            (unsigned long) pgtime_mean_us(&s));
+    for (uint8_t i = 0; i < PGTIME_BINS; ++i) {
+        if (i < PGTIME_BINS - 1) {
+            print_P(PSTR("  < %6lu us: %u\n"),
+                    (unsigned long) PGTIME_BIN0_US << i, s.hist[i]);
+        } else {
+            print_P(PSTR(" >= %6lu us: %u\n"),
+                    (unsigned long) PGTIME_BIN0_US << (i - 1), s.hist[i]);
+        }
+    }
+}
+
+
+static PGM_P sup_state_name(uint8_t state)
+{
+    switch (state) {
+    case SUP_SETTLING:      return PSTR("settling");
+    case SUP_GOOD:          return PSTR("good");
+    case SUP_SUPERVISED:    return PSTR("supervised");
+    case SUP_BACKOFF:       return PSTR("FAULT (retrying)");
+    case SUP_LATCHED:       return PSTR("FAULT (latched)");
+    default:                return PSTR("off");
+    }
+}
+
+
+static void retry(char const * supply, char const * count)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg) {
+        print_P(PSTR("unrecognized supply: %s\n"), supply);
+        return;
+    }
+
+    if (count) {
+        int n = atoi(count);
+        if (n < 0 || n > 255) {
+            print_P(PSTR("retry count out of range: %s\n"), count);
+        } else {
+            sup_set_retry_limit(reg, n);
+        }
+    }
+
+    struct sup_stats s = sup_get(reg);
+    print_P(PSTR("state: %S  retries: %u max\n"),
+            sup_state_name(s.state), s.retry_limit);
+    print_P(PSTR("faults: %u  retried: %u  latched: %u  consecutive: %u\n"),
+            s.faults, s.retries, s.latches, s.failures);
+}
+
+
+static void deglitch(char const * supply, char const * samples)
+{
+    int nsupply = resolve_supply(supply);
+    reg_type * reg = map_supply(nsupply);
+    if (!reg) {
+        print_P(PSTR("unrecognized supply: %s\n"), supply);
+        return;
+    }
+
+    if (samples) {
+        int n = atoi(samples);
+        if (n < 1 || n > 255) {
+            print_P(PSTR("deglitch out of range: %s\n"), samples);
+        } else {
+            sup_set_deglitch(reg, n);
+        }
+    }
+
+    print_P(PSTR("deglitch: %u samples, adds up to %u ms to fault detection\n"),
+            sup_get(reg).deglitch, sup_get_deglitch_latency(reg));
+}
+
+
+static PGM_P supply_name(uint8_t id)
+{
+    return id < REG_N_IDS ? supply_names[id] : PSTR("?");
+}
+
+
+static void print_event(struct evlog_entry const * e)
+{
+    print_P(PSTR("%10lu ms  "), (unsigned long) e->ms);
+    switch (e->type) {
+    case EV_ENABLE:
+        print_P(PSTR("enable %S\n"), supply_name(e->arg));
+        break;
+    case EV_DISABLE:
+        print_P(PSTR("disable %S\n"), supply_name(e->arg));
+        break;
+    case EV_PG_RISE:
+        print_P(PSTR("PG rise %S\n"), supply_name(e->arg));
+        break;
+    case EV_PG_FALL:
+        print_P(PSTR("PG fall %S\n"), supply_name(e->arg));
+        break;
+    case EV_SUPERVISION:
+        print_P(PSTR("%S %S\n"), supply_name(e->arg >> 4),
+                sup_state_name(e->arg & 0x0f));
+        break;
+    case EV_STANDBY_ENTER:
+        puts_P(PSTR("enter standby"));
+        break;
+    case EV_STANDBY_EXIT:
+        puts_P(PSTR("exit standby"));
+        break;
+    case EV_CMD_UART:
+        print_P(PSTR("UART command '%c'\n"), e->arg);
+        break;
+    case EV_CMD_I2C:
+        print_P(PSTR("I2C write 0x%02x\n"), e->arg);
+        break;
+    case EV_RESET:
+        print_P(PSTR("reset, cause 0x%02x\n"), e->arg);
+        break;
+    case EV_ALARM:
+        print_P(PSTR("alarm, action %u\n"), e->arg);
+        break;
+    case EV_POWER_FAIL:
+        print_P(PSTR("power fail, cut in %u cycles\n"), e->arg);
+        break;
+    case EV_WATCHDOG:
+        print_P(PSTR("watchdog reset, missing 0x%02x\n"), e->arg);
+        break;
+    default:
+        print_P(PSTR("event %u 0x%02x\n"), e->type, e->arg);
+        break;
+    }
+}
+
+
+// Print and remove everything in the event log.
+static void log_drain(void)
+{
+    struct evlog_entry e;
+    if (evlog_dropped()) {
+        print_P(PSTR("(%u events dropped)\n"), evlog_dropped());
+    }
+    while (evlog_peek(&e)) {
+        evlog_pop();
+        print_event(&e);
+    }
+}
+
+
+// Save the current settings and enabled supplies as the power-on profile.
+static void save_profile(void)
+{
+    struct profile prof;
+    uint8_t enable_bm = 0;
+    for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+        if (CONTROL[nsupply] & CTRL_BIT_ENABLED) {
+            enable_bm |= bm(nsupply - 1);
+        }
+    }
+    profile_capture(&prof, enable_bm);
+    profile_save(&prof);
+}
+
+
+// Load and apply the power-on profile, including its enabled supplies. The
+// keep-alive supply is always enabled.
+// @return true on error
+static bool load_profile(void)
+{
+    struct profile prof;
+    if (profile_load(&prof)) {
+        return true;
+    }
+    profile_apply(&prof);
+    for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+        request_supply(nsupply, (prof.enable_bm & bm(nsupply - 1)) ||
+                map_supply(nsupply) == SUPPLY_KEEP_ALIVE);
+    }
+    return false;
+}
+
+
+// Time spent waiting for VCC to settle at boot, in ms
+static uint16_t ramp_ms = 0;
+
+
+// Profile operation requested over I2C, done from the main loop
+#define PROFILE_REQ_SAVE    1
+#define PROFILE_REQ_LOAD    2
+static volatile uint8_t profile_request = 0;
+
+
+// Phase changes written over I2C, by supply number. A phase change can wait
+// for a sync period boundary, so it is applied from the main loop rather
+// than the TWI interrupt.
+static volatile uint8_t phase_request[REG_N_IDS + 1];
+static volatile uint8_t phase_pending_bm = 0;
+
+
+// What to do when the alarm fires, and the interval to re-arm it at
+#define ALARM_ACTION_WAKE   0   // only leave standby
+#define ALARM_ACTION_UP     1   // power up every supply
+#define ALARM_ACTION_LOAD   2   // load and apply the power-on profile
+static volatile uint8_t alarm_action = ALARM_ACTION_WAKE;
+static volatile uint16_t alarm_period_s = 0;
+
+static void alarm_task(void)
+{
+    if (!alarm_take()) {
+        return;
+    }
+    evlog(EV_ALARM, alarm_action);
+    if (alarm_period_s) {
+        alarm_set(alarm_period_s);
+    }
+
+    switch (alarm_action) {
+    case ALARM_ACTION_UP:
+        power_all(true);
+        break;
+    case ALARM_ACTION_LOAD:
+        load_profile();
+        break;
+    }
+}
+
+
+// Cycles the last power-fail interrupt took to cut the supplies
+static volatile uint16_t pfail_cycles = 0;
+
+// After the power-fail interrupt has cut every supply, bring the regulator
+// and sequencer state in line and keep the supplies off until requested
+// again. INT stays asserted until the EC releases it.
+static void power_fail_task(void)
+{
+    uint16_t cycles;
+    if (!power_fail_take(&cycles)) {
+        return;
+    }
+    evlog(EV_POWER_FAIL, cycles > UINT8_MAX ? UINT8_MAX : cycles);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pfail_cycles = cycles;
+    }
+
+    // Clearing the last-enabled state as well keeps the monitor from seeing
+    // an edge, which would start the keep-alive restart
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+            CONTROL[nsupply] &= ~(CTRL_BIT_ENABLED | CTRL_BIT_L_ENABLED);
+        }
+    }
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        reg_type * reg = reg_of_id(id);
+        seq_request(reg, false);
+        reg_disable(reg);
+        if (reg_is_buck(reg)) {
+            reg_buck_reattach(reg);
+        }
+    }
+    power_fail_release();
+}
+
+
+static void alarm(int argc, char ** argv)
+{
+    if (argc > 1) {
+        if (!strcmp_P(argv[1], PSTR("off"))) {
+            alarm_period_s = 0;
+            alarm_set(0);
+        } else {
+            uint8_t action = ALARM_ACTION_WAKE;
+            if (argc > 2 && !strcmp_P(argv[2], PSTR("up"))) {
+                action = ALARM_ACTION_UP;
+            } else if (argc > 2 && !strcmp_P(argv[2], PSTR("load"))) {
+                action = ALARM_ACTION_LOAD;
+            }
+            alarm_action = action;
+            alarm_period_s = argc > 3 ? (uint16_t) atol(argv[3]) : 0;
+            alarm_set((uint16_t) atol(argv[1]));
+        }
+    }
+
+    uint32_t left = alarm_remaining_ms();
+    if (left) {
+        print_P(PSTR("alarm in %lu ms, action %u, every %u s\n"),
+                (unsigned long) left, alarm_action, alarm_period_s);
+    } else {
+        puts_P(PSTR("alarm off"));
+    }
+}
+
+
+#if FMT_BENCH
+static void null_putc(char c)
+{
+    (void) c;
+}
+
+static int null_put(char c, FILE * stream)
+{
+    (void) c;
+    (void) stream;
+    return 0;
+}
+
+static FILE null_stream = FDEV_SETUP_STREAM(null_put, NULL, _FDEV_SETUP_WRITE);
+#endif
+
+
+// Compare the cost of the power-good check through the vtable and through
+// static dispatch, in CPU cycles per call.
+static void bench(void)
+{
+    uint16_t t[4];
+    bool volatile sink;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t[0] = TICK_TIMER.CNT;
+        for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+            sink = reg_is_power_good(reg_of_id(i));
+        }
+        t[1] = TICK_TIMER.CNT;
+        for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+            sink = reg_id_is_power_good(i);
+        }
+        t[2] = TICK_TIMER.CNT;
+#define X(name) sink = reg_id_is_power_good(CONCAT(REG_ID_, name));
+        REG_BUCKS(X)
+        REG_INVS(X)
+#undef X
+        t[3] = TICK_TIMER.CNT;
+    }
+    (void) sink;
+
+    print_P(PSTR("vtable: %u  switch: %u  constant: %u cycles/call\n"),
+            (t[1] - t[0]) / REG_N_IDS,
+            (t[2] - t[1]) / REG_N_IDS,
+            (t[3] - t[2]) / REG_N_IDS);
+
+#if FMT_BENCH
+    // A 'stat' line, formatted into a sink that drops it
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        t[0] = TICK_TIMER.CNT;
+        fprintf_P(&null_stream, PSTR("enabled: %c  power good: %c  %S\n"),
+                'Y', 'Y', sup_state_name(SUP_SUPERVISED));
+        t[1] = TICK_TIMER.CNT;
+        fmt_P(&null_putc, PSTR("enabled: %c  power good: %c  %S\n"),
+                'Y', 'Y', sup_state_name(SUP_SUPERVISED));
+        t[2] = TICK_TIMER.CNT;
+    }
+    print_P(PSTR("stat line: printf_P %u  print_P %u cycles\n"),
+            t[1] - t[0], t[2] - t[1]);
+#endif
+}
+
+
+static PGM_P perf_name(uint8_t id)
+{
+    switch (id) {
+    case PERF_MONITOR:  return PSTR("monitor");
+    case PERF_BIST:     return PSTR("bist");
+    case PERF_LEDS:     return PSTR("leds");
+    case PERF_SHELL:    return PSTR("shell");
+    case PERF_TICK_ISR: return PSTR("tick ISR");
+    case PERF_TWI_ISR:  return PSTR("TWI ISR");
+    default:            return PSTR("?");
+    }
+}
+
+
+static void print_perf(PGM_P name, struct perf_stats const * s)
+{
+    print_P(PSTR("%-9S %5u %8lu %8lu %8lu\n"), name, s->count,
+            (unsigned long) s->min, (unsigned long) s->max,
+            (unsigned long) perf_mean(s));
+}
+
+
+// Print the profiler statistics in cycles and start over
+static void perf(void)
+{
+#if PERF
+    struct perf_stats stats[PERF_N_IDS];
+    struct perf_loop_stats loop;
+    perf_take(stats, &loop);
+
+    puts_P(PSTR("          count      min      max     mean"));
+    for (uint8_t id = 0; id < PERF_N_IDS; ++id) {
+        print_perf(perf_name(id), &stats[id]);
+    }
+    print_perf(PSTR("loop"), &loop.period);
+
+    uint32_t limit = PERF_BIN0_CYCLES;
+    for (uint8_t i = 0; i < PERF_BINS; ++i, limit <<= 1) {
+        if (i < PERF_BINS - 1) {
+            print_P(PSTR("  < %6lu: %u\n"), (unsigned long) limit,
+                    loop.hist[i]);
+        } else {
+            print_P(PSTR("  >=%6lu: %u\n"), (unsigned long) (limit >> 1),
+                    loop.hist[i]);
+        }
+    }
+#else
+    puts_P(PSTR("profiler disabled (PERF)"));
+#endif
+}
+
+
+static void mem(void)
+{
+    struct mem_report r;
+    mem_scan();
+    mem_get(&r);
+    print_P(PSTR("data: %u  bss: %u  heap: %u\n"), r.data, r.bss, r.heap);
+    print_P(PSTR("stack: %u now, %u max  never used: %u of %u\n"),
+            r.stack_now, r.stack_max, r.unused, RAMEND + 1 - RAMSTART);
+}
+
+
+static void wdog(void)
+{
+    print_P(PSTR("timeout: %u ms  window opens: %u ms  fed at: %u ms\n"),
+            WDOG_TIMEOUT_MS, WDOG_CLOSED_MS, WDOG_OPEN_MS);
+    print_P(PSTR("longest between feeds: %u ms\n"), wdog_max_interval_ms());
+
+    uint8_t missing = wdog_last_reset();
+    if (missing) {
+        print_P(PSTR("last reset by watchdog, missing:"));
+        if (missing & bm(WDOG_TICK)) {
+            print_P(PSTR(" tick"));
+        }
+        for (uint8_t i = 0; i < sched_count(); ++i) {
+            if (WDOG_TASK(i) < WDOG_SOURCES && (missing & bm(WDOG_TASK(i)))) {
+                print_P(PSTR(" %S"), sched_name(i));
+            }
+        }
+        putchar('\n');
     }
 }
 
 
+// Print the scheduler statistics and start over
+static void sched(void)
+{
+    puts_P(PSTR("task       runs misses  late"));
+    for (uint8_t i = 0; i < sched_count(); ++i) {
+        struct sched_stats s = sched_take(i);
+        print_P(PSTR("%-8S %6u %6u %5u\n"), sched_name(i), s.runs,
+                s.misses, s.max_late_ms);
+    }
+}
+
+
+// Shell command handlers. The command table below checks the argument
+// counts, so argv[1] is there for every command that takes a supply.
+
+static void sh_en(int argc, char ** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        en_dis(argv[i], true);
+    }
+}
+
+static void sh_dis(int argc, char ** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        en_dis(argv[i], false);
+    }
+}
+
+static void sh_stat(int argc, char ** argv)
+{
+    (void) argc;
+    int supply = resolve_supply(argv[1]);
+    if (supply > 0 && supply <= REG_N_IDS) {
+        bool enabled = reg_is_enabled(map_supply(supply));
+        bool pg = seq_is_power_good(map_supply(supply));
+        print_P(PSTR("enabled: %c  power good: %c  %S\n"),
+                enabled ? 'Y' : 'N',
+                pg ? 'Y' : 'N',
+                sup_state_name(sup_get(map_supply(supply)).state));
+        if (DCDC_PWM && reg_is_buck(map_supply(supply))) {
+            print_P(PSTR("gate latency: %u cycles max\n"),
+                    reg_buck_get_gate_latency(map_supply(supply)));
+        }
+        if (reg_is_buck(map_supply(supply))) {
+            struct bist_result res = bist_get(map_supply(supply));
+            print_P(PSTR("sync test: %S  period %u (%+d)  edge %u (%+d)\n"),
+                    bist_status_name(res.status),
+                    res.period, res.period_err,
+                    res.edge, res.phase_err);
+        }
+    } else {
+        print_P(PSTR("unrecognized supply: %s\n"), argv[1]);
+    }
+}
+
+static void sh_phase(int argc, char ** argv)
+{
+    phase(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_duty(int argc, char ** argv)
+{
+    duty(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_softstart(int argc, char ** argv)
+{
+    softstart(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_freq(int argc, char ** argv)
+{
+    freq(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_pgtime(int argc, char ** argv)
+{
+    pgtime(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_retry(int argc, char ** argv)
+{
+    retry(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_deglitch(int argc, char ** argv)
+{
+    deglitch(argv[1], argc > 2 ? argv[2] : NULL);
+}
+
+static void sh_up(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    power_all(true);
+}
+
+static void sh_down(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    power_all(false);
+}
+
+static void sh_log(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    log_drain();
+}
+
+static void sh_plog(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    plog_read(&print_event);
+}
+
+static void sh_save(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    save_profile();
+}
+
+static void sh_load(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    if (load_profile()) {
+        puts_P(PSTR("no valid profile"));
+    }
+}
+
+static void sh_telem(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    int16_t t = adc_temp_dc();
+    print_P(PSTR("VCC: %u mV  temp: %d.%u C  samples: %u\n"),
+            adc_vcc_mv(), t / 10, (unsigned) abs(t % 10),
+            adc_sample_count());
+}
+
+static void sh_pfail(int argc, char ** argv)
+{
+    if (argc > 1 && !strcmp_P(argv[1], PSTR("clear"))) {
+        set_int(false);
+    }
+    print_P(PSTR("threshold: %u mV  power fails: %u  last cut: %u cycles\n"),
+            PFAIL_MV, power_fail_count(), pfail_cycles);
+}
+
+static void sh_boot(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    print_P(PSTR("VCC dwell: %u ms (limit %u ms)\n"),
+            ramp_ms, RAMP_MAX_MS);
+    print_P(PSTR("VCC: %u mV\n"), adc_vcc_mv());
+}
+
+static void sh_bench(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    bench();
+}
+
+static void sh_perf(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    perf();
+}
+
+static void sh_mem(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    mem();
+}
+
+static void sh_sched(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    sched();
+}
+
+static void sh_wdog(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    wdog();
+}
+
+static void sh_standby(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    power_all(false);
+    for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+        seq_request(map_supply(nsupply),
+                map_supply(nsupply) == SUPPLY_KEEP_ALIVE);
+    }
+    evlog(EV_STANDBY_ENTER, 0);
+    standby();
+}
+
+static void sh_help(int argc, char ** argv)
+{
+    (void) argc;
+    (void) argv;
+    cmd_help();
+    print_P(PSTR("\nsupplies:"));
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        print_P(PSTR(" %S"), supply_names[id]);
+    }
+    print_P(PSTR("\n"));
+}
+
+#define COMMANDS(X) \
+    X(en,        &sh_en,        1, CMD_ANY_ARGS, "SUPPLY...") \
+    X(dis,       &sh_dis,       1, CMD_ANY_ARGS, "SUPPLY...") \
+    X(stat,      &sh_stat,      1, 1, "SUPPLY") \
+    X(up,        &sh_up,        0, 0, "") \
+    X(down,      &sh_down,      0, 0, "") \
+    X(phase,     &sh_phase,     1, 2, "SUPPLY [DEGREES]") \
+    X(duty,      &sh_duty,      1, 2, "SUPPLY [PERCENT]") \
+    X(freq,      &sh_freq,      1, 2, "SUPPLY [KHZ]") \
+    X(softstart, &sh_softstart, 1, 2, "SUPPLY [MS]") \
+    X(pgtime,    &sh_pgtime,    1, 2, "SUPPLY [clear]") \
+    X(retry,     &sh_retry,     1, 2, "SUPPLY [COUNT]") \
+    X(deglitch,  &sh_deglitch,  1, 2, "SUPPLY [SAMPLES]") \
+    X(log,       &sh_log,       0, 0, "") \
+    X(plog,      &sh_plog,      0, 0, "") \
+    X(alarm,     &alarm,        0, 3, "[off | SECONDS [wake|up|load [PERIOD]]]") \
+    X(save,      &sh_save,      0, 0, "") \
+    X(load,      &sh_load,      0, 0, "") \
+    X(telem,     &sh_telem,     0, 0, "") \
+    X(pfail,     &sh_pfail,     0, 1, "[clear]") \
+    X(boot,      &sh_boot,      0, 0, "") \
+    X(bench,     &sh_bench,     0, 0, "") \
+    X(perf,      &sh_perf,      0, 0, "") \
+    X(mem,       &sh_mem,       0, 0, "") \
+    X(sched,     &sh_sched,     0, 0, "") \
+    X(wdog,      &sh_wdog,      0, 0, "") \
+    X(standby,   &sh_standby,   0, 0, "") \
+    X(help,      &sh_help,      0, 0, "")
+CMD_TABLE(commands, COMMANDS);
+
+
 void esh_cb(esh_t * esh, int argc, char ** argv, void * arg)
 {
     (void) esh;
@@ -101,48 +950,53 @@ void esh_cb(esh_t * esh, int argc, char ** argv, void * arg)
     if (argc < 1) {
         return;
     }
-    int supply = resolve_supply(argv[1]);
+    evlog(EV_CMD_UART, argv[0][0]);
+    cmd_dispatch(argc, argv);
+}
 
-    if (!strcmp_P(argv[0], PSTR("en"))) {
-        for (int i = 1; i < argc; ++i) {
-            en_dis(argv[i], true);
-        }
-    } else if (!strcmp_P(argv[0], PSTR("dis"))) {
-        for (int i = 1; i < argc; ++i) {
-            en_dis(argv[i], false);
-        }
-    } else if (!strcmp_P(argv[0], PSTR("stat"))) {
-        if (argc < 2) {
-            return;
+
+// Restart of the keep-alive supply: wait for the sequencer to take it down,
+// then discharge it for KEEP_ALIVE_DELAY_MS and request it again
+static enum {
+    KEEP_ALIVE_IDLE,
+    KEEP_ALIVE_STOPPING,
+    KEEP_ALIVE_DISCHARGING,
+} keep_alive_state = KEEP_ALIVE_IDLE;
+static uint8_t keep_alive_nsupply;
+static uint32_t keep_alive_since_ms;
+
+static void keep_alive_step(void)
+{
+    switch (keep_alive_state) {
+    case KEEP_ALIVE_IDLE:
+        break;
+    case KEEP_ALIVE_STOPPING:
+        // The sequencer takes down its children first
+        if (!reg_is_enabled(SUPPLY_KEEP_ALIVE)) {
+            P3B_DISCH_PORT.OUTCLR = bm(P3B_DISCH_bp);
+            keep_alive_since_ms = uptime_ms();
+            keep_alive_state = KEEP_ALIVE_DISCHARGING;
         }
-        if (supply > 0 && supply < 6) {
-            bool enabled = reg_is_enabled(map_supply(supply));
-            bool pg = reg_is_power_good(map_supply(supply));
-            printf_P(PSTR("enabled: %c  power good: %c\n"),
-                    enabled ? 'Y' : 'N',
-                    pg ? 'Y' : 'N');
+        break;
+    case KEEP_ALIVE_DISCHARGING:
+        if (uptime_ms() - keep_alive_since_ms >= KEEP_ALIVE_DELAY_MS) {
+            request_supply(keep_alive_nsupply, true);
+            keep_alive_state = KEEP_ALIVE_IDLE;
         }
-    } else if (!strcmp_P(argv[0], PSTR("standby"))) {
-        standby();
-    } else if (!strcmp_P(argv[0], PSTR("help"))) {
-        puts_P(PSTR("en SUPPLY"));
-        puts_P(PSTR("dis SUPPLY"));
-        puts_P(PSTR("stat SUPPLY"));
-        puts_P(PSTR("standby"));
-        puts_P(PSTR(""));
-        puts_P(PSTR("supplies: 3VA, 3VB, 5VA, 5VB, N12"));
+        break;
     }
 }
 
 
-void monitor_task(void)
+// Check the next supply's CONTROL register and status
+static void monitor_next(void)
 {
     static uint8_t nsupply = 1;
     static bool found_bad = false;
 
     reg_type * supply = map_supply(nsupply);
-    bool en = reg_is_enabled(supply);
-    bool pg = reg_is_power_good(supply);
+    bool en = reg_id_is_enabled(nsupply - 1);
+    bool pg = seq_is_power_good(supply);
     bool sw = false;
     bool enable = false;
 
@@ -168,17 +1022,17 @@ void monitor_task(void)
     if (sw) {
         if (enable) {
             if (supply == SUPPLY_KEEP_ALIVE) {
+                keep_alive_state = KEEP_ALIVE_IDLE;
                 P3B_DISCH_PORT.OUTSET = bm(P3B_DISCH_bp);
             }
 
-            reg_enable(supply, true);
+            seq_request(supply, true);
         } else {
-            reg_disable(supply);
+            seq_request(supply, false);
 
             if (supply == SUPPLY_KEEP_ALIVE) {
-                P3B_DISCH_PORT.OUTCLR = bm(P3B_DISCH_bp);
-                _delay_ms(KEEP_ALIVE_DELAY_MS);
-                CONTROL[nsupply] |= CTRL_BIT_ENABLED;
+                keep_alive_nsupply = nsupply;
+                keep_alive_state = KEEP_ALIVE_STOPPING;
             }
         }
     }
@@ -187,29 +1041,37 @@ void monitor_task(void)
         found_bad = false;
     }
 
-    if (!pg && en) {
+    if ((en && !sup_is_power_good(supply)) || sup_is_faulted(supply)) {
         found_bad = true;
     }
 
     set_led(LED_SFY, found_bad);
 
     uint16_t led = 0;
-    switch (nsupply) {
-    case 1: led = LED_P5A; break;
-    case 2: led = LED_P5B; break;
-    case 3: led = LED_P3A; break;
-    case 4: led = LED_P3B; break;
-    case 5: led = LED_N12; break;
+    switch (nsupply - 1) {
+#define X(name) case CONCAT(REG_ID_, name): led = CONCAT(LED_, name); break;
+    REG_BUCKS(X)
+    REG_INVS(X)
+#undef X
     }
     set_led(led, pg && en);
 
     nsupply += 1;
-    if (nsupply == 6) {
+    if (nsupply > REG_N_IDS) {
         nsupply = 1;
     }
 }
 
 
+void monitor_task(void)
+{
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        monitor_next();
+    }
+    keep_alive_step();
+}
+
+
 void esh_printer(esh_t * esh, char c, void * arg)
 {
     (void) esh;
@@ -218,80 +1080,488 @@ void esh_printer(esh_t * esh, char c, void * arg)
 }
 
 
-// I2C interface follows the usual "address, data" form, where the addresses
-// are the supply numbers (1-indexed here as everywhere else). Each byte is
-// a bitfield with:
+// I2C interface follows the usual "address, data" form. The low nibble of
+// the address is the supply number (1-indexed here as everywhere else), and
+// the high nibble selects a register block:
+//
+//  0xA0    EVLOG, read-only block with the oldest event log entry: type (see
+//          enum evlog_type), argument, time in ms (32-bit LE), then the number
+//          of entries in the log and the number dropped. Type is 0 if the log
+//          is empty. Any write removes the oldest entry, so the log is drained
+//          by alternating reads and writes.
+//
+//  0xB0    PROFILE, write 1 to save the current settings and enabled
+//          supplies as the power-on profile, 2 to load and apply it. Reads
+//          as nonzero while the operation is pending.
+//  0xB1    SEQUENCE, write 1 to request every supply on, 0 to request every
+//          supply but 3VB off; the sequencer orders the transitions. Reads
+//          1 once all requested supplies are in their requested state.
+//
+//  0xC0    ALARM, write the number of seconds until the alarm fires, 0 to
+//          cancel. Reads as a block: seconds left (16-bit LE), action,
+//          period (16-bit LE).
+//  0xC1    ALARM_ACTION, what the alarm does besides leaving standby: 0 for
+//          nothing, 1 to power up every supply, 2 to load the profile.
+//  0xC2    ALARM_PERIOD, seconds to re-arm the alarm at after it fires, 0
+//          for a one-shot alarm.
+//
+//  0xD0    TELEMETRY, read-only block: VCC in mV, die temperature in 0.1
+//          degC (signed), and a count of ADC conversions that wraps, each
+//          16-bit LE.
+//
+//  0xE0    PFAIL, read-only block: number of power fails since reset, and
+//          cycles the last one took to cut the supplies, each 16-bit LE. A
+//          power fail cuts every supply and asserts INT; any write releases
+//          INT. Supplies stay off until requested again.
+//
+//  0xF0    MEM, read-only block, each 16-bit LE: static data (.data, .bss
+//          and heap), the deepest stack seen, and the SRAM never used. The
+//          stack is rescanned once a second.
+//
+//  0x0n    CONTROL, a bitfield with:
 //      ENABLED     = 1 << 0
 //      POWER_GOOD  = 1 << 1
 //      RESERVED    = 1 << 2    // used to track previous ENABLED state
 //      INVALID     = 1 << 7
+//
+//  0x1n    PHASE, buck SYNC phase in 1/256 of a period. Reads as 0 on
+//          supplies without a SYNC output; unsupported values are ignored.
+//          Writes take effect from the main loop, within about 10 ms.
+//
+//  0x2n    FREQ, buck sync frequency in units of 10 kHz. Shared by all bucks
+//          on the same sync timer. Reads as 0 on supplies without a SYNC
+//          output; out of range values are ignored.
+//
+//  0x3n    DUTY, buck SYNC pulse width in 1/256 of a period. Writes set the
+//          width used at phase 0; reads return the width currently
+//          generated. Out of range values are ignored.
+//
+//  0x4n    SOFTSTART, buck soft-start time in ms, 0 for none.
+//
+//  0x5n    BIST, read-only block with the latest sync self-test result:
+//          status (see enum bist_status), period error, phase error (both
+//          signed, in cycles), period (16-bit LE), edge position (16-bit LE).
+//
+//  0x6n    PGTIME, read-only block with time-to-power-good statistics, each
+//          16-bit LE: sample count, then min, max and mean in units of 16 us
+//          (saturating). Any write clears the statistics.
+//
+//  0x7n    PGHIST, read-only block with the time-to-power-good histogram,
+//          one saturating 8-bit count per bin (see pgtime.h).
+//
+//  0x8n    RETRY, block with the supervision state (see enum sup_state),
+//          retry limit, consecutive failures, latch-offs, total faults
+//          (16-bit LE) and retries (16-bit LE). Writes set the retry limit.
+//
+//  0x9n    DEGLITCH, block with the PG deglitch threshold in tick samples,
+//          then the worst-case delay it adds to fault detection in ms (16-bit
+//          LE). Writes set the threshold; 0 is taken as 1.
+#define I2C_ADDR_EVLOG      0xA0
+#define I2C_ADDR_PROFILE    0xB0
+#define I2C_ADDR_SEQUENCE   0xB1
+#define I2C_ADDR_ALARM      0xC0
+#define I2C_ADDR_ALARM_ACTION   0xC1
+#define I2C_ADDR_ALARM_PERIOD   0xC2
+#define I2C_ADDR_TELEMETRY  0xD0
+#define I2C_ADDR_PFAIL      0xE0
+#define I2C_ADDR_MEM        0xF0
+#define I2C_BLK_CONTROL 0x00
+#define I2C_BLK_PHASE   0x10
+#define I2C_BLK_FREQ    0x20
+#define I2C_BLK_DUTY    0x30
+#define I2C_BLK_SOFTSTART   0x40
+#define I2C_BLK_BIST    0x50
+#define I2C_BLK_PGTIME  0x60
+#define I2C_BLK_PGHIST  0x70
+#define I2C_BLK_RETRY   0x80
+#define I2C_BLK_DEGLITCH    0x90
+_Static_assert(PGTIME_BINS <= TWIS_SEND_BUFFER_SIZE,
+        "PGHIST block must fit the I2C send buffer");
 
-void twi_callback(TWI_Slave_t * packet)
+static void i2c_put16(register8_t * buf, uint16_t value)
 {
-    static uint8_t active_supply = 0;
-    uint8_t supply = packet->receivedData[0];
-    if (supply >= 1 && supply <= 5) {
-        active_supply = supply;
-    } else {
-        active_supply = 0;
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+static uint16_t i2c_us16(uint32_t us)
+{
+    us /= 16;
+    return us > UINT16_MAX ? UINT16_MAX : us;
+}
+
+static uint8_t i2c_read_byte(uint8_t addr)
+{
+    if (addr == I2C_ADDR_SEQUENCE) {
+        return seq_is_settled();
+    }
+    if (addr == I2C_ADDR_PROFILE) {
+        return profile_request;
     }
 
-    uint8_t outindex = packet->bytesReceived;
-    if (outindex == 0) {
-        if (active_supply >= 1 && active_supply <= 5) {
-            packet->sendData[outindex] = CONTROL[active_supply];
-        } else {
-            packet->sendData[outindex] = CTRL_BIT_INVALID;
+    uint8_t nsupply = addr & 0x0f;
+    reg_type * reg = map_supply(nsupply);
+    if (!reg) {
+        return CTRL_BIT_INVALID;
+    }
+
+    switch (addr & 0xf0) {
+    case I2C_BLK_CONTROL:
+        return CONTROL[nsupply];
+    case I2C_BLK_PHASE:
+        return reg_is_buck(reg) ? reg_buck_get_phase(reg) : 0;
+    case I2C_BLK_DUTY:
+        return reg_is_buck(reg) ? reg_buck_get_duty(reg) : 0;
+    case I2C_BLK_SOFTSTART:
+        return reg_is_buck(reg) ? reg_buck_get_softstart(reg) : 0;
+    case I2C_BLK_FREQ:
+        return reg_is_buck(reg)
+            ? (reg_buck_get_frequency(reg) + 5000) / 10000
+            : 0;
+    default:
+        return CTRL_BIT_INVALID;
+    }
+}
+
+// Fill the I2C send buffer for a read of addr. Most registers are a single
+// byte; blocks fill more of the buffer.
+static void i2c_read(uint8_t addr, register8_t * buf)
+{
+    buf[0] = i2c_read_byte(addr);
+
+    if (addr == I2C_ADDR_TELEMETRY) {
+        i2c_put16(&buf[0], adc_vcc_mv());
+        i2c_put16(&buf[2], adc_temp_dc());
+        i2c_put16(&buf[4], adc_sample_count());
+        return;
+    }
+
+    if (addr == I2C_ADDR_MEM) {
+        struct mem_report r;
+        mem_get(&r);
+        i2c_put16(&buf[0], r.data + r.bss + r.heap);
+        i2c_put16(&buf[2], r.stack_max);
+        i2c_put16(&buf[4], r.unused);
+        return;
+    }
+
+    if (addr == I2C_ADDR_PFAIL) {
+        i2c_put16(&buf[0], power_fail_count());
+        i2c_put16(&buf[2], pfail_cycles);
+        return;
+    }
+
+    if (addr == I2C_ADDR_ALARM) {
+        i2c_put16(&buf[0], (alarm_remaining_ms() + 999) / 1000);
+        buf[2] = alarm_action;
+        i2c_put16(&buf[3], alarm_period_s);
+        return;
+    }
+
+    if (addr == I2C_ADDR_EVLOG) {
+        struct evlog_entry e = { .type = EV_NONE };
+        evlog_peek(&e);
+        buf[0] = e.type;
+        buf[1] = e.arg;
+        i2c_put16(&buf[2], e.ms & 0xffff);
+        i2c_put16(&buf[4], e.ms >> 16);
+        buf[6] = evlog_count();
+        buf[7] = evlog_dropped();
+        return;
+    }
+
+    reg_type * reg = map_supply(addr & 0x0f);
+    if (!reg) {
+        return;
+    }
+
+    switch (addr & 0xf0) {
+    case I2C_BLK_BIST:
+        if (reg_is_buck(reg)) {
+            struct bist_result res = bist_get(reg);
+            buf[0] = res.status;
+            buf[1] = res.period_err;
+            buf[2] = res.phase_err;
+            i2c_put16(&buf[3], res.period);
+            i2c_put16(&buf[5], res.edge);
         }
-    } else {
+        break;
+    case I2C_BLK_PGTIME: {
+        struct pgtime_stats s = pgtime_get(reg);
+        i2c_put16(&buf[0], s.count);
+        i2c_put16(&buf[2], i2c_us16(s.min_us));
+        i2c_put16(&buf[4], i2c_us16(s.max_us));
+        i2c_put16(&buf[6], i2c_us16(pgtime_mean_us(&s)));
+        break;
+    }
+    case I2C_BLK_PGHIST: {
+        struct pgtime_stats s = pgtime_get(reg);
+        for (uint8_t i = 0; i < PGTIME_BINS; ++i) {
+            buf[i] = s.hist[i] > UINT8_MAX ? UINT8_MAX : s.hist[i];
+        }
+        break;
+    }
+    case I2C_BLK_RETRY: {
+        struct sup_stats s = sup_get(reg);
+        buf[0] = s.state;
+        buf[1] = s.retry_limit;
+        buf[2] = s.failures;
+        buf[3] = s.latches;
+        i2c_put16(&buf[4], s.faults);
+        i2c_put16(&buf[6], s.retries);
+        break;
+    }
+    case I2C_BLK_DEGLITCH:
+        buf[0] = sup_get(reg).deglitch;
+        i2c_put16(&buf[1], sup_get_deglitch_latency(reg));
+        break;
+    }
+}
+
+static void i2c_write(uint8_t addr, uint8_t value)
+{
+    if (addr == I2C_ADDR_EVLOG) {
+        evlog_pop();
+        return;
+    }
+
+    evlog(EV_CMD_I2C, addr);
+
+    if (addr == I2C_ADDR_SEQUENCE) {
+        power_all(value);
+        return;
+    }
+    if (addr == I2C_ADDR_PROFILE) {
+        profile_request = value;
+        return;
+    }
+    if (addr == I2C_ADDR_ALARM) {
+        alarm_set(value);
+        return;
+    }
+    if (addr == I2C_ADDR_ALARM_ACTION) {
+        alarm_action = value;
+        return;
+    }
+    if (addr == I2C_ADDR_ALARM_PERIOD) {
+        alarm_period_s = value;
+        return;
+    }
+    if (addr == I2C_ADDR_PFAIL) {
+        set_int(false);
+        return;
+    }
+
+    uint8_t nsupply = addr & 0x0f;
+    reg_type * reg = map_supply(nsupply);
+    if (!reg) {
+        return;
+    }
+
+    switch (addr & 0xf0) {
+    case I2C_BLK_CONTROL: {
         // Only allow certain bits to be changed
         const uint8_t allowed_bits = CTRL_BIT_ENABLED;
-        uint8_t bits_to_set = packet->receivedData[outindex] & allowed_bits;
-        CONTROL[active_supply] = (CONTROL[active_supply] & ~allowed_bits) | bits_to_set;
+        uint8_t bits_to_set = value & allowed_bits;
+        CONTROL[nsupply] = (CONTROL[nsupply] & ~allowed_bits) | bits_to_set;
+        break;
+    }
+    case I2C_BLK_PHASE:
+        if (reg_is_buck(reg)) {
+            phase_request[nsupply] = value;
+            phase_pending_bm |= bm(nsupply);
+        }
+        break;
+    case I2C_BLK_DUTY:
+        if (reg_is_buck(reg)) {
+            reg_buck_set_duty(reg, value);
+        }
+        break;
+    case I2C_BLK_SOFTSTART:
+        if (reg_is_buck(reg)) {
+            reg_buck_set_softstart(reg, value);
+        }
+        break;
+    case I2C_BLK_FREQ:
+        if (reg_is_buck(reg)) {
+            reg_buck_set_frequency(reg, 10000uL * value);
+        }
+        break;
+    case I2C_BLK_PGTIME:
+        pgtime_clear(reg);
+        break;
+    case I2C_BLK_RETRY:
+        sup_set_retry_limit(reg, value);
+        break;
+    case I2C_BLK_DEGLITCH:
+        sup_set_deglitch(reg, value);
+        break;
+    }
+}
+
+void twi_callback(TWI_Slave_t * packet)
+{
+    static uint8_t active_addr = 0;
+
+    uint8_t outindex = packet->bytesReceived;
+    if (outindex == 0) {
+        active_addr = packet->receivedData[0];
+        i2c_read(active_addr, packet->sendData);
+    } else {
+        i2c_write(active_addr, packet->receivedData[outindex]);
+    }
+}
+
+
+static void pin_change(uint8_t pins, uint32_t us)
+{
+    pgtime_edge(pins, us);
+
+    uint8_t in = DCDC_PG_PORT.IN;
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        uint8_t pg_bm = reg_id_pg_bm(id);
+        if (pins & pg_bm) {
+            evlog((in & pg_bm) ? EV_PG_RISE : EV_PG_FALL, id);
+        }
     }
 }
 
 
+static void tick_callback(void)
+{
+    reg_tick();
+    sup_tick();
+    seq_tick();
+    wdog_checkin(WDOG_TICK);
+}
+
+
+static esh_t * shell;
+
+// Feed received characters to the shell
+static void shell_task(void)
+{
+    int c;
+    while ((c = uart_receive()) > 0) {
+        if (c == '\r') c = '\n';
+        esh_rx(shell, (char) c);
+    }
+}
+
+
+static void profile_task(void)
+{
+    uint8_t req;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        req = profile_request;
+        profile_request = 0;
+    }
+    switch (req) {
+    case PROFILE_REQ_SAVE:
+        save_profile();
+        break;
+    case PROFILE_REQ_LOAD:
+        load_profile();
+        break;
+    }
+}
+
+
+static void phase_task(void)
+{
+    uint8_t pending;
+    uint8_t turn[REG_N_IDS + 1];
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pending = phase_pending_bm;
+        phase_pending_bm = 0;
+        for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+            turn[nsupply] = phase_request[nsupply];
+        }
+    }
+    for (int nsupply = 1; nsupply <= REG_N_IDS; ++nsupply) {
+        if (pending & bm(nsupply)) {
+            reg_buck_set_phase(map_supply(nsupply), turn[nsupply]);
+        }
+    }
+}
+
+
+static void standby_task(void)
+{
+    static bool was_standby = false;
+    bool standby_now = in_standby();
+    if (was_standby && !standby_now) {
+        evlog(EV_STANDBY_EXIT, 0);
+    } else if (was_standby && standby_now) {
+        // Arm the RX wake from the second pass in standby on, a task period
+        // after the command that entered it, so the rest of that line
+        // cannot wake it at once. Leaving standby disarms it again.
+        enable_wake();
+    }
+    was_standby = standby_now;
+}
+
+
+// Main-loop tasks, in the order they run when due. Periods and deadlines are
+// in ms; period 0 runs on every pass.
+static struct sched_task const tasks[] PROGMEM = {
+    { power_fail_task,  0,            0,    PERF_N_IDS,   true,  "pfail" },
+    { monitor_task,     1,            1,    PERF_MONITOR, true,  "monitor" },
+    { shell_task,       0,            0,    PERF_SHELL,   false, "shell" },
+    { led_cycle,        1,            2,    PERF_LEDS,    false, "leds" },
+    { bist_task,        10,           10,   PERF_BIST,    false, "bist" },
+    { alarm_task,       10,           10,   PERF_N_IDS,   false, "alarm" },
+    { profile_task,     10,           100,  PERF_N_IDS,   false, "profile" },
+    { phase_task,       10,           10,   PERF_N_IDS,   false, "phase" },
+    { standby_task,     10,           10,   PERF_N_IDS,   false, "standby" },
+    { mem_scan,         MEM_CHECK_MS, 100,  PERF_N_IDS,   false, "mem" },
+};
+
+
 int main(void)
 {
     init_ports();
     init_clock();
-    reg_probe(reg_P5A);
-    reg_probe(reg_P5B);
-    reg_probe(reg_P3A);
-    reg_probe(reg_P3B);
-    reg_probe(reg_N12);
+    init_timebase();
+    init_adc();
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        reg_probe(reg_of_id(id));
+    }
     init_uart();
     stdout = &uart_stdout;
+    init_fmt(&console_putc);
     init_twi(&twi_callback);
+    init_tick(&tick_callback);
+    init_bist();
+    init_pin_change(&pin_change);
+    init_perf();
+    load_profile();
+    init_plog();
+    evlog(EV_RESET, RST.STATUS);
+    init_wdog();
+    RST.STATUS = RST.STATUS;
     PMIC.CTRL = PMIC_LOLVLEN_bm | PMIC_MEDLVLEN_bm | PMIC_HILVLEN_bm;
     sei();
 
-    esh_t * esh = esh_init();
-    esh_register_command(esh, &esh_cb, NULL);
-    esh_register_print(esh, &esh_printer, NULL);
+    shell = esh_init();
+    cmd_register(commands, sizeof(commands) / sizeof(commands[0]));
+    esh_register_command(shell, &esh_cb, NULL);
+    esh_register_print(shell, &esh_printer, NULL);
 
     // Delay startup until the input rail has come *fully* up, don't risk
     // glitching it by powering up the regs while it's just high enough to
-    // power this MCU
-    _delay_ms(40);
+    // power this MCU. Only VCC can be measured, so this is just a dwell
+    // past VCC reaching regulation, capped at the old fixed delay.
+    ramp_ms = adc_wait_input_ramp();
+    adc_start_telemetry();
+    init_power_fail();
 
+    init_sched(tasks, sizeof(tasks) / sizeof(tasks[0]));
     for(;;) {
-        monitor_task();
-        led_cycle();
+        perf_loop();
+        sched_poll();
 
-        int c = uart_receive();
-        if (c > 0) {
-            if (c == '\r') c = '\n';
-            esh_rx(esh, (char) c);
-        }
-
-        if (in_standby()) {
-            // Delay at least one baud cycle to avoid instant wakeup.
-            // The clock has been cut by 256, so this is a much longer
-            // delay than what it looks like.
-            _delay_us(100);
-            enable_wake();
-        }
+        // Any interrupt wakes: the next tick, RX, I2C, or the alarm
+        idle();
     }
 }
@@ -0,0 +1,54 @@
+#include "mem.h"
+#include "hardware.h"
+#include <avr/io.h>
+#include <util/atomic.h>
+
+extern uint8_t __data_start, __data_end;
+extern uint8_t __bss_start, __bss_end;
+extern uint8_t __noinit_start, __noinit_end;
+extern uint8_t __heap_start;
+extern char * __brkval;
+
+static volatile uint16_t stack_max = 0;
+
+// Runs from .init3, before the stack is used and before .data and .bss are
+// initialized, so it must not touch either.
+void mem_paint(void) __attribute__((naked, used, section(".init3")));
+void mem_paint(void)
+{
+    for (uint8_t * p = &__heap_start; p < (uint8_t *) SP; ++p) {
+        *p = MEM_PAINT;
+    }
+}
+
+// Return the end of the heap
+static uint8_t * heap_end(void)
+{
+    return __brkval ? (uint8_t *) __brkval : &__heap_start;
+}
+
+void mem_scan(void)
+{
+    uint8_t * p = heap_end();
+    while (p <= (uint8_t *) RAMEND && *p == MEM_PAINT) {
+        ++p;
+    }
+    uint16_t depth = RAMEND + 1 - (uint16_t) p;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stack_max = depth;
+    }
+}
+
+void mem_get(struct mem_report * report)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        report->stack_max = stack_max;
+        report->heap = heap_end() - &__heap_start;
+    }
+    report->data = &__data_end - &__data_start;
+    report->bss = (&__bss_end - &__bss_start) +
+        (&__noinit_end - &__noinit_start);
+    report->stack_now = RAMEND - SP;
+    report->unused = RAMEND + 1 - (uint16_t) &__heap_start -
+        report->heap - report->stack_max;
+}
@@ -0,0 +1,30 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <inttypes.h>
+
+// SRAM usage. Before main() runs, everything between the static data and the
+// stack pointer is painted with MEM_PAINT. The deepest the stack has grown
+// is then found by scanning up from the static data for the first byte
+// that was overwritten. Nothing is allocated from the heap, so the painted
+// bytes that remain are the SRAM that has never been used.
+
+#define MEM_PAINT       0xc5
+
+struct mem_report {
+    uint16_t data;          // .data
+    uint16_t bss;           // .bss and .noinit
+    uint16_t heap;          // allocated with malloc()
+    uint16_t stack_now;
+    uint16_t stack_max;     // deepest stack seen
+    uint16_t unused;        // never touched, between the heap and stack_max
+};
+
+// Find the deepest the stack has been so far.
+void mem_scan(void);
+
+// Fill in a report, with the stack depth found by the last scan. Interrupt
+// safe.
+void mem_get(struct mem_report * report);
+
+#endif // MEM_H
@@ -0,0 +1,95 @@
+#include "perf.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#if PERF
+
+static volatile uint16_t perf_ovf = 0;
+static struct perf_stats stats[PERF_N_IDS];
+static struct perf_loop_stats loop_stats;
+static uint32_t loop_start = 0;
+
+void init_perf(void)
+{
+    PERF_TIMER.INTCTRLA =
+        (PERF_TIMER.INTCTRLA & ~TC45_OVFINTLVL_gm) | TC45_OVFINTLVL_LO_gc;
+}
+
+uint32_t perf_now(void)
+{
+    uint16_t ovf, cnt;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ovf = perf_ovf;
+        cnt = PERF_TIMER.CNT;
+        // An overflow that has happened but not been counted yet
+        if ((PERF_TIMER.INTFLAGS & TC5_OVFIF_bm) && cnt < 0x8000) {
+            ++ovf;
+        }
+    }
+    return (uint32_t) ovf << 16 | cnt;
+}
+
+static uint8_t bin_of(uint32_t cycles)
+{
+    uint8_t bin = 0;
+    for (uint32_t limit = PERF_BIN0_CYCLES;
+            cycles >= limit && bin < PERF_BINS - 1; limit <<= 1) {
+        ++bin;
+    }
+    return bin;
+}
+
+static void record(struct perf_stats * s, uint32_t cycles)
+{
+    if (s->count == UINT16_MAX) {
+        return;
+    }
+    if (!s->count || cycles < s->min) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    s->sum += cycles;
+    ++s->count;
+}
+
+void perf_record(uint8_t id, uint32_t start)
+{
+    uint32_t cycles = perf_now() - start;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        record(&stats[id], cycles);
+    }
+}
+
+void perf_loop(void)
+{
+    uint32_t now = perf_now();
+    if (loop_start) {
+        uint32_t cycles = now - loop_start;
+        record(&loop_stats.period, cycles);
+        if (loop_stats.hist[bin_of(cycles)] < UINT16_MAX) {
+            ++loop_stats.hist[bin_of(cycles)];
+        }
+    }
+    loop_start = now;
+}
+
+void perf_take(struct perf_stats out[PERF_N_IDS], struct perf_loop_stats * loop)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(out, stats, sizeof(stats));
+        memset(stats, 0, sizeof(stats));
+    }
+    *loop = loop_stats;
+    memset(&loop_stats, 0, sizeof(loop_stats));
+    loop_start = 0;
+}
+
+ISR(PERF_OVF_vect)
+{
+    ++perf_ovf;
+}
+
+#endif // PERF
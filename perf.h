@@ -0,0 +1,80 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "hardware.h"
+#include <inttypes.h>
+
+// Cycle profiler. Main-loop tasks and interrupt handlers are timed against
+// PERF_TIMER, extended to 32 bits by counting its overflows, and kept as
+// min/max/mean per task. The time between main-loop iterations is also kept
+// as a histogram with bins doubling in width: bin 0 counts periods under
+// PERF_BIN0_CYCLES, bin n those under PERF_BIN0_CYCLES << n, and the last bin
+// everything longer.
+//
+// Task times include any interrupts taken while the task ran. Each
+// measurement itself costs a few tens of cycles. With PERF at 0 all of this
+// compiles to nothing.
+
+#define PERF_BINS           8
+#define PERF_BIN0_CYCLES    256
+
+enum perf_id {
+    PERF_MONITOR,
+    PERF_BIST,
+    PERF_LEDS,
+    PERF_SHELL,
+    PERF_TICK_ISR,
+    PERF_TWI_ISR,
+    PERF_N_IDS
+};
+
+struct perf_stats {
+    uint16_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+};
+
+struct perf_loop_stats {
+    struct perf_stats period;
+    uint16_t hist[PERF_BINS];
+};
+
+#if PERF
+
+void init_perf(void);
+
+// Return the current time in cycles.
+uint32_t perf_now(void);
+
+// Record a run of a task that started at the given perf_now() time.
+void perf_record(uint8_t id, uint32_t start);
+
+// Mark the start of a main-loop iteration.
+void perf_loop(void);
+
+// Copy out the statistics of every task and of the loop period, then clear
+// them.
+void perf_take(struct perf_stats stats[PERF_N_IDS],
+        struct perf_loop_stats * loop);
+
+#else
+
+static inline void init_perf(void) {}
+static inline uint32_t perf_now(void) { return 0; }
+static inline void perf_record(uint8_t id, uint32_t start)
+{
+    (void) id;
+    (void) start;
+}
+static inline void perf_loop(void) {}
+
+#endif // PERF
+
+// Return the mean time in cycles, or 0 if nothing has been measured.
+static inline uint32_t perf_mean(struct perf_stats const * s)
+{
+    return s->count ? s->sum / s->count : 0;
+}
+
+#endif // PERF_H
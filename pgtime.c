@@ -0,0 +1,97 @@
+#include "pgtime.h"
+#include "hardware.h"
+#include <util/atomic.h>
+#include <string.h>
+
+// Indexed by supply ID
+static struct pgtime_stats stats[REG_N_IDS];
+// Enable timestamps of running measurements
+static uint32_t start_us[REG_N_IDS];
+static volatile uint8_t pending_bm = 0;
+
+static uint8_t bin_of(uint32_t us)
+{
+    uint8_t bin = 0;
+    for (uint32_t limit = PGTIME_BIN0_US; us >= limit && bin < PGTIME_BINS - 1;
+            limit <<= 1) {
+        ++bin;
+    }
+    return bin;
+}
+
+static void record(uint8_t n, uint32_t us)
+{
+    struct pgtime_stats * s = &stats[n];
+    if (s->count == UINT16_MAX) {
+        return;
+    }
+    if (!s->count || us < s->min_us) {
+        s->min_us = us;
+    }
+    if (us > s->max_us) {
+        s->max_us = us;
+    }
+    s->sum_us += us;
+    ++s->count;
+    ++s->hist[bin_of(us)];
+}
+
+void pgtime_edge(uint8_t pins, uint32_t now_us)
+{
+    pins &= DCDC_PG_PORT.IN;
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        if ((pins & reg_id_pg_bm(i)) && (pending_bm & bm(i))) {
+            pending_bm &= ~bm(i);
+            record(i, now_us - start_us[i]);
+        }
+    }
+}
+
+void pgtime_start(regptr reg)
+{
+    int8_t n = reg_id_of(reg);
+    if (n < 0) {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        start_us[n] = uptime_us();
+        pending_bm |= bm(n);
+    }
+}
+
+void pgtime_cancel(regptr reg)
+{
+    int8_t n = reg_id_of(reg);
+    if (n >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            pending_bm &= ~bm(n);
+        }
+    }
+}
+
+struct pgtime_stats pgtime_get(regptr reg)
+{
+    struct pgtime_stats s = {0};
+    int8_t n = reg_id_of(reg);
+    if (n >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            s = stats[n];
+        }
+    }
+    return s;
+}
+
+void pgtime_clear(regptr reg)
+{
+    int8_t n = reg_id_of(reg);
+    if (n >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            memset(&stats[n], 0, sizeof(stats[n]));
+        }
+    }
+}
+
+uint32_t pgtime_mean_us(struct pgtime_stats const * s)
+{
+    return s->count ? s->sum_us / s->count : 0;
+}
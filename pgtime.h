@@ -0,0 +1,45 @@
+#ifndef PGTIME_H
+#define PGTIME_H
+
+#include "regulator.h"
+#include <inttypes.h>
+
+// Time-to-power-good measurement. Each enable of a supply from the off state
+// is timestamped, and the next rising edge of its PG pin completes the
+// measurement. Rise times are kept per supply as min/max/mean and a
+// histogram with bins doubling in width: bin 0 counts rises under
+// PGTIME_BIN0_US, bin n those under PGTIME_BIN0_US << n, and the last bin
+// everything longer.
+
+#define PGTIME_BINS     8
+#define PGTIME_BIN0_US  256
+
+struct pgtime_stats {
+    uint16_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t sum_us;
+    uint16_t hist[PGTIME_BINS];
+};
+
+// Complete measurements on PG edges. Called from the pin change interrupt
+// with the PG pins that saw an edge; only rising edges count.
+void pgtime_edge(uint8_t pins, uint32_t now_us);
+
+// Mark the start of a measurement. Called by the regulator drivers when a
+// supply is enabled from the off state.
+void pgtime_start(regptr reg);
+
+// Abandon a running measurement. Called when a supply is disabled.
+void pgtime_cancel(regptr reg);
+
+// Return the statistics of a supply. count is 0 for unknown supplies.
+struct pgtime_stats pgtime_get(regptr reg);
+
+// Clear the statistics of a supply.
+void pgtime_clear(regptr reg);
+
+// Return the mean rise time in us, or 0 if nothing has been measured.
+uint32_t pgtime_mean_us(struct pgtime_stats const * stats);
+
+#endif // PGTIME_H
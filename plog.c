@@ -0,0 +1,139 @@
+#include "plog.h"
+#include "hardware.h"
+#include "supervisor.h"
+#include "eeprom.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+struct plog_record {
+    uint16_t seq;       // PLOG_SEQ_EMPTY in erased records
+    struct evlog_entry entry;
+} __attribute__((packed));
+
+#define PLOG_SEQ_EMPTY  0xffff
+#define PLOG_RECORDS    ((uint8_t) (PLOG_SIZE / sizeof(struct plog_record)))
+
+_Static_assert(EPAGESIZE % sizeof(struct plog_record) == 0,
+        "plog records must not cross EEPROM pages");
+_Static_assert(PLOG_START % EPAGESIZE == 0 && PLOG_SIZE % EPAGESIZE == 0 &&
+        PLOG_START + PLOG_SIZE <= EEPROM_SIZE,
+        "plog must be whole EEPROM pages");
+_Static_assert(PLOG_SIZE / sizeof(struct plog_record) <= UINT8_MAX,
+        "plog slots are counted in a byte");
+_Static_assert((PLOG_QUEUE & (PLOG_QUEUE - 1)) == 0,
+        "PLOG_QUEUE must be a power of two");
+
+static struct plog_record queue[PLOG_QUEUE];
+static uint8_t q_head = 0;
+static volatile uint8_t q_count = 0;
+static volatile bool paused = false;
+
+static uint16_t next_seq = 0;
+static uint8_t next_slot = 0;
+
+static uint16_t slot_addr(uint8_t slot)
+{
+    return PLOG_START + slot * sizeof(struct plog_record);
+}
+
+void init_plog(void)
+{
+    bool found = false;
+    uint16_t newest = 0;
+    for (uint8_t slot = 0; slot < PLOG_RECORDS; ++slot) {
+        uint16_t seq;
+        ee_read(slot_addr(slot), &seq, sizeof(seq));
+        if (seq == PLOG_SEQ_EMPTY) {
+            continue;
+        }
+        if (!found || (int16_t) (seq - newest) > 0) {
+            found = true;
+            newest = seq;
+            next_slot = (uint8_t) (slot + 1) < PLOG_RECORDS ? slot + 1 : 0;
+        }
+    }
+    next_seq = found ? newest + 1 : 0;
+}
+
+bool plog_is_critical(uint8_t type, uint8_t arg)
+{
+    if (type == EV_RESET || type == EV_POWER_FAIL || type == EV_WATCHDOG) {
+        return true;
+    }
+    if (type == EV_SUPERVISION) {
+        uint8_t state = arg & 0x0f;
+        return state == SUP_BACKOFF || state == SUP_LATCHED;
+    }
+    return false;
+}
+
+void plog_write(struct evlog_entry const * entry)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (q_count < PLOG_QUEUE) {
+            queue[(q_head + q_count) & (PLOG_QUEUE - 1)].entry = *entry;
+            ++q_count;
+            if (!paused) {
+                NVM.INTCTRL = NVM_EELVL_LO_gc;
+            }
+        }
+    }
+}
+
+static void write_record(struct plog_record * rec)
+{
+    if (next_seq == PLOG_SEQ_EMPTY) {
+        next_seq = 0;
+    }
+    rec->seq = next_seq++;
+    ee_write(slot_addr(next_slot), rec, sizeof(*rec));
+    next_slot = (uint8_t) (next_slot + 1) < PLOG_RECORDS ? next_slot + 1 : 0;
+}
+
+ISR(NVM_EE_vect)
+{
+    if (!q_count) {
+        NVM.INTCTRL = 0;
+        return;
+    }
+    write_record(&queue[q_head]);
+    q_head = (q_head + 1) & (PLOG_QUEUE - 1);
+    --q_count;
+}
+
+void plog_read(void (* callback)(struct evlog_entry const * entry))
+{
+    plog_pause();
+
+    for (uint8_t i = 0; i < PLOG_RECORDS; ++i) {
+        uint8_t slot = next_slot + i;
+        if (slot >= PLOG_RECORDS) {
+            slot -= PLOG_RECORDS;
+        }
+        struct plog_record rec;
+        ee_read(slot_addr(slot), &rec, sizeof(rec));
+        if (rec.seq != PLOG_SEQ_EMPTY) {
+            callback(&rec.entry);
+        }
+    }
+
+    plog_resume();
+}
+
+void plog_pause(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        paused = true;
+        NVM.INTCTRL = 0;
+    }
+}
+
+void plog_resume(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        paused = false;
+        if (q_count) {
+            NVM.INTCTRL = NVM_EELVL_LO_gc;
+        }
+    }
+}
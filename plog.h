@@ -0,0 +1,32 @@
+#ifndef PLOG_H
+#define PLOG_H
+
+#include "evlog.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Persistent event log. Critical events are copied from the event log into
+// a circular log in EEPROM that survives resets. Records carry a sequence
+// number, so the newest one is found at boot and each location is written
+// once per lap of the log. Writes are queued and done one record at a time
+// from the EEPROM ready interrupt, so recording never waits on the EEPROM.
+
+void init_plog(void);
+
+// Queue an event for writing. Interrupt safe. Dropped if the queue is full.
+void plog_write(struct evlog_entry const * entry);
+
+// Return whether an event type is persisted.
+bool plog_is_critical(uint8_t type, uint8_t arg);
+
+// Read the log, oldest first. Pending writes are paused while reading.
+// @param callback - called with each record in turn
+void plog_read(void (* callback)(struct evlog_entry const * entry));
+
+// Pause pending writes, e.g. around other EEPROM use, and resume them. A
+// write already started may still be in progress after plog_pause(); the
+// EEPROM functions wait for it.
+void plog_pause(void);
+void plog_resume(void);
+
+#endif // PLOG_H
@@ -0,0 +1,96 @@
+#include "profile.h"
+#include "hardware.h"
+#include "eeprom.h"
+#include "plog.h"
+#include "sequencer.h"
+#include "supervisor.h"
+#include <util/crc16.h>
+#include <stddef.h>
+
+_Static_assert(PROFILE_START % EPAGESIZE == 0 &&
+        PROFILE_START + sizeof(struct profile) <= EEPROM_SIZE,
+        "profile must fit in EEPROM");
+
+static uint16_t profile_crc(struct profile const * prof)
+{
+    uint16_t crc = 0xffff;
+    uint8_t const * data = (uint8_t const *) prof;
+    for (uint8_t i = 0; i < offsetof(struct profile, crc); ++i) {
+        crc = _crc_ccitt_update(crc, data[i]);
+    }
+    return crc;
+}
+
+void profile_capture(struct profile * prof, uint8_t enable_bm)
+{
+    *prof = (struct profile) {
+        .version = PROFILE_VERSION,
+        .enable_bm = enable_bm,
+    };
+
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        regptr reg = reg_of_id(id);
+        prof->delay_ms[id] = seq_get_delay(reg);
+        struct sup_stats stats = sup_get(reg);
+        prof->retry_limit[id] = stats.retry_limit;
+        prof->deglitch[id] = stats.deglitch;
+        if (reg_is_buck(reg)) {
+            prof->buck[id] = (struct profile_buck) {
+                .phase = reg_buck_get_phase(reg),
+                // The phase-0 setting; reg_buck_get_duty() gives the width
+                // as generated, which follows the phase when it is nonzero
+                .duty = reg__buck(reg)->state->duty,
+                .ss_ms = reg_buck_get_softstart(reg),
+                .freq = (reg_buck_get_frequency(reg) + 5000) / 10000,
+            };
+        }
+    }
+}
+
+void profile_apply(struct profile const * prof)
+{
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        regptr reg = reg_of_id(id);
+        seq_set_delay(reg, prof->delay_ms[id]);
+        sup_set_retry_limit(reg, prof->retry_limit[id]);
+        sup_set_deglitch(reg, prof->deglitch[id]);
+        if (reg_is_buck(reg)) {
+            struct profile_buck const * buck = &prof->buck[id];
+            // Settings that don't fit the hardware are skipped, leaving the
+            // defaults in place.
+            reg_buck_set_frequency(reg, 10000uL * buck->freq);
+            reg_buck_set_duty(reg, buck->duty);
+            reg_buck_set_phase(reg, buck->phase);
+            reg_buck_set_softstart(reg, buck->ss_ms);
+        }
+    }
+}
+
+void profile_save(struct profile * prof)
+{
+    prof->crc = profile_crc(prof);
+
+    // Keep the persistent log from writing between the pages, and wait for
+    // each page with interrupts enabled.
+    plog_pause();
+    uint8_t const * data = (uint8_t const *) prof;
+    uint8_t offset = 0;
+    while (offset < sizeof(*prof)) {
+        uint8_t n = EPAGESIZE - (PROFILE_START + offset) % EPAGESIZE;
+        if (n > sizeof(*prof) - offset) {
+            n = sizeof(*prof) - offset;
+        }
+        while (ee_busy());
+        ee_write(PROFILE_START + offset, data + offset, n);
+        offset += n;
+    }
+    plog_resume();
+}
+
+bool profile_load(struct profile * prof)
+{
+    plog_pause();
+    ee_read(PROFILE_START, prof, sizeof(*prof));
+    plog_resume();
+    return prof->version != PROFILE_VERSION || prof->crc != profile_crc(prof);
+}
@@ -0,0 +1,45 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "regulator.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Power-on profile. The settings below are saved to EEPROM with a CRC, and
+// applied at reset if the CRC matches, so the card can bring its supplies up
+// without waiting for the EC.
+
+#define PROFILE_VERSION 1
+
+struct profile_buck {
+    uint8_t phase;
+    uint8_t duty;
+    uint8_t ss_ms;
+    uint8_t freq;       // in 10 kHz
+};
+
+struct profile {
+    uint8_t version;
+    uint8_t enable_bm;              // supplies enabled at reset, by ID
+    uint8_t delay_ms[REG_N_IDS];    // sequencer delays
+    uint8_t retry_limit[REG_N_IDS];
+    uint8_t deglitch[REG_N_IDS];
+    struct profile_buck buck[REG_N_IDS];  // unused for non-bucks
+    uint16_t crc;
+};
+
+// Fill a profile from the current settings.
+// @param enable_bm - supplies to enable at reset, by ID
+void profile_capture(struct profile * prof, uint8_t enable_bm);
+
+// Apply a profile's settings, except enable_bm, which is up to the caller.
+void profile_apply(struct profile const * prof);
+
+// Write a profile to EEPROM. Blocks until written, a few ms per page.
+void profile_save(struct profile * prof);
+
+// Read the profile from EEPROM.
+// @return true on error (no profile, bad CRC or wrong version)
+bool profile_load(struct profile * prof);
+
+#endif // PROFILE_H
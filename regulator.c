@@ -1,4 +1,7 @@
 #include "regulator.h"
+#include "pgtime.h"
+#include "evlog.h"
+#include <util/atomic.h>
 
 static bool reg_buck_probe(regptr reg);
 static bool reg_buck_enable(regptr reg, bool sync);
@@ -13,6 +16,11 @@ static bool reg_inv_is_enabled(regptr reg);
 static bool reg_inv_is_power_good(regptr reg);
 
 #define def_buck(name) \
+    struct reg_buck_state CONCAT(CONCAT(reg_, name), _state) = { \
+        .phase = CONCAT(name, _PHASE), \
+        .duty  = DCDC_DUTY, \
+        .ss_ms = CONCAT(name, _SOFTSTART_MS), \
+    }; \
     static reg_buck_type CONCAT(CONCAT(reg_, name), _) = { \
         .base = { \
             reg_buck_probe, \
@@ -20,19 +28,29 @@ static bool reg_inv_is_power_good(regptr reg);
             reg_buck_disable, \
             reg_buck_is_enabled, \
             reg_buck_is_power_good }, \
+        .state     = &CONCAT(CONCAT(reg_, name), _state), \
+        .timer     = (TC4_t volatile *) &CONCAT(name, _SYNC_TIMER), \
         .sync_port = &CONCAT(name, _SYNC_PORT), \
         .pg_port   = &CONCAT(name, _PG_PORT), \
         .sync_bm   = bm(CONCAT(name, _SYNC_bp)), \
         .pg_bm     = bm(CONCAT(name, _PG_bp)), \
         .sync_cc_bm = bm(CONCAT(name, _SYNC_CC_bp)), \
-        .phase_180 = CONCAT(name, _PHASE_180), \
+        .sync_cc   = CONCAT(name, _SYNC_CC_bp) / 2, \
+        .duty_min  = CONCAT(name, _DUTY_MIN), \
+        .duty_max  = CONCAT(name, _DUTY_MAX), \
     }; \
+    _Static_assert(DCDC_PWM || \
+            CONCAT(name, _PHASE) == 0 || CONCAT(name, _PHASE) == 128, \
+            #name " phase needs DCDC_PWM"); \
     reg_type * CONCAT(reg_, name) = &CONCAT(CONCAT(reg_, name), _).base;
 
-def_buck(P5A)
-def_buck(P5B)
-def_buck(P3A)
-def_buck(P3B)
+REG_BUCKS(def_buck)
+
+static regptr const bucks[] = {
+#define X(name) &CONCAT(CONCAT(reg_, name), _).base,
+    REG_BUCKS(X)
+#undef X
+};
 
 #define def_inv(name) \
     static reg_inv_type CONCAT(CONCAT(reg_, name), _) = { \
@@ -49,70 +67,345 @@ def_buck(P3B)
     }; \
     reg_type * CONCAT(reg_, name) = &CONCAT(CONCAT(reg_, name), _).base;
 
-def_inv(N12)
+REG_INVS(def_inv)
+
+// Compare value for the buck's SYNC output in PWM mode, given the timer's PER.
+// The output is set at BOTTOM and cleared on compare match. At phase 0 that
+// match ends the pulse; for nonzero phases the output is inverted so that the
+// rising edge lands on the compare match. While the buck is off or
+// unsynchronized, the compare value holds the output: a value of BOTTOM keeps
+// the waveform low, one above PER keeps it high.
+static uint16_t reg_buck_cc_value(regptr reg, uint16_t per)
+{
+    struct reg_buck_state * state = reg__buck(reg)->state;
+
+    if (!DCDC_PWM) {
+        return 0;
+    } else if (state->mode != BUCK_SYNC) {
+        bool high = (state->mode == BUCK_UNSYNC) != (state->phase != 0);
+        return high ? 0xffffu : 0;
+    } else {
+        uint8_t edge = state->phase ? state->phase : state->duty;
+        uint16_t cc = ((uint32_t) edge * (per + 1) + 128) >> 8;
+        // Compare values of 0 or above PER would hold the output constant
+        if (cc < 1) cc = 1;
+        if (cc > per) cc = per;
+        return cc;
+    }
+}
+
+static bool reg_buck_duty_ok(regptr reg, uint8_t width)
+{
+    return width >= reg__buck(reg)->duty_min &&
+        width <= reg__buck(reg)->duty_max;
+}
+
+// Pin sense is set to the pin's rising edge (which is a falling edge when
+// inverted) for the self-test.
+static uint8_t reg_buck_pinctrl(regptr reg)
+{
+    return PORT_OPC_TOTEM_gc |
+        (reg__buck(reg)->state->phase
+         ? PORT_INVEN_bm | PORT_ISC_FALLING_gc
+         : PORT_ISC_RISING_gc);
+}
+
+static void reg_buck_set_pinctrl(regptr reg, uint8_t pinctrl)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PORTCFG.MPCMASK = reg__buck(reg)->sync_bm;
+        reg__buck(reg)->sync_port->PIN0CTRL = pinctrl;
+    }
+}
+
+// Top value (PER in PWM mode, CCA in frequency mode) for a sync frequency
+static uint16_t dcdc_top(uint32_t freq)
+{
+    if (DCDC_PWM) {
+        return (F_CPU + freq / 2) / freq - 1;
+    } else {
+        // From XMEGA AU manual, p 172:
+        // fFRQ = fclkper / (2 PRESC (CCA + 1))
+        return (F_CPU + freq) / (2 * /* presc */ 1 * freq) - 1;
+    }
+}
+
+// The top value is written to both the register and its buffer, so that the
+// buffer always holds the value in effect as of the next period.
+static void dcdc_timer_init(TC4_t volatile * timer, uint32_t freq)
+{
+    timer->CTRLA = TC45_CLKSEL_DIV1_gc;
+    if (DCDC_PWM) {
+        timer->CTRLB = TC45_WGMODE_SINGLESLOPE_gc;
+        timer->PER = timer->PERBUF = dcdc_top(freq);
+    } else {
+        timer->CTRLB = TC45_WGMODE_FRQ_gc;
+        timer->CCA = timer->CCABUF = dcdc_top(freq);
+    }
+}
+
+static uint16_t dcdc_top_of(TC4_t volatile * timer)
+{
+    return DCDC_PWM ? timer->PERBUF : timer->CCABUF;
+}
+
+static void dcdc_wait_update(TC4_t volatile * timer)
+{
+    timer->INTFLAGS = TC4_OVFIF_bm;
+    while (!(timer->INTFLAGS & TC4_OVFIF_bm));
+}
+
+// Write the buck's compare buffer from its state. The timer copies it in at
+// the next period boundary, so the output only ever changes between whole
+// pulses. Returns the number of cycles until that boundary, i.e. the latency
+// of the change, which is at most one sync period.
+static uint16_t reg_buck_load_cc(regptr reg)
+{
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+    uint16_t latency;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        (&timer->CCABUF)[reg__buck(reg)->sync_cc] =
+            reg_buck_cc_value(reg, dcdc_top_of(timer));
+        latency = timer->PER - timer->CNT + 1;
+    }
+    return latency;
+}
+
+// Switch the pin inversion of a buck's SYNC output to match its phase. The
+// inversion and the waveform cannot change in the same cycle, so the pin is
+// released onto its pull-down while the compare channel settles on the held
+// low level for the new inversion, and driven again after a period boundary.
+// The output is low for up to two periods. Only the register writes are
+// atomic; the wait for the boundary leaves interrupts enabled. A gate change
+// from an interrupt meanwhile only writes the compare buffer, which the pin
+// follows once it is driven again.
+static void reg_buck_set_inversion(regptr reg, bool was_inverted)
+{
+    struct reg_buck_state * state = reg__buck(reg)->state;
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        reg_buck_set_pinctrl(reg, PORT_OPC_PULLDOWN_gc |
+                (was_inverted ? PORT_INVEN_bm : 0));
+        reg__buck(reg)->sync_port->DIRCLR = reg__buck(reg)->sync_bm;
+
+        // Waveform level that holds the pin low, as for BUCK_OFF
+        (&timer->CCA)[reg__buck(reg)->sync_cc] =
+            (&timer->CCABUF)[reg__buck(reg)->sync_cc] =
+            state->phase ? 0xffffu : 0;
+        reg_buck_set_pinctrl(reg, PORT_OPC_PULLDOWN_gc |
+                (state->phase ? PORT_INVEN_bm : 0));
+        timer->CTRLE |= reg__buck(reg)->sync_cc_bm;
+        timer->INTFLAGS = TC4_OVFIF_bm;
+    }
+
+    while (!(timer->INTFLAGS & TC4_OVFIF_bm));
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        reg__buck(reg)->sync_port->DIRSET = reg__buck(reg)->sync_bm;
+        reg_buck_set_pinctrl(reg, reg_buck_pinctrl(reg));
+        reg_buck_load_cc(reg);
+    }
+}
+
+// Load a new top value into a sync timer, rescaling the compare buffers of
+// every channel on it so they keep their phase. Takes effect at the next
+// period boundary.
+static void dcdc_load_top(TC4_t volatile * timer, uint16_t top)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (DCDC_PWM) {
+            timer->PERBUF = top;
+            for (uint8_t i = 0; i < sizeof(bucks) / sizeof(bucks[0]); ++i) {
+                if (reg__buck(bucks[i])->timer == timer) {
+                    (&timer->CCABUF)[reg__buck(bucks[i])->sync_cc] =
+                        reg_buck_cc_value(bucks[i], top);
+                }
+            }
+        } else {
+            timer->CCABUF = top;
+        }
+    }
+}
 
 // Buck probe handles the entire system at once, due to needing to configure
-// the timer. This function tracks whether it has been run, and only runs once,
-// allowing calling code to still 'probe' each regulator.
+// the timers. That part tracks whether it has been run, and only runs once,
+// allowing calling code to still 'probe' each regulator. Only the compare
+// channel is set up per regulator.
 static bool reg_buck_probe(regptr reg)
 {
-    (void) reg;
     static bool has_run = false;
-    if (has_run) return false;
-    has_run = true;
+    if (!has_run) {
+        has_run = true;
 
-    PORTCFG.MPCMASK = DCDC_SYNC_gm;
-    DCDC_SYNC_PORT.PIN0CTRL = PORT_OPC_TOTEM_gc;
-    DCDC_SYNC_PORT.OUTCLR = DCDC_SYNC_gm;
-    DCDC_SYNC_PORT.DIRSET = DCDC_SYNC_gm;
+        // In PWM mode the pins are driven by their compare channels from
+        // the start; they are held on their pull-downs until then.
+        PORTCFG.MPCMASK = DCDC_SYNC_gm;
+        DCDC_SYNC_PORT.PIN0CTRL = DCDC_PWM ? PORT_OPC_PULLDOWN_gc : PORT_OPC_TOTEM_gc;
+        DCDC_SYNC_PORT.OUTCLR = DCDC_SYNC_gm;
+        if (!DCDC_PWM) {
+            DCDC_SYNC_PORT.DIRSET = DCDC_SYNC_gm;
+        }
 
-    PORTCFG.MPCMASK = DCDC_PG_gm;
-    DCDC_PG_PORT.PIN0CTRL = PORT_OPC_PULLUP_gc;
-    DCDC_PG_PORT.DIRCLR = DCDC_PG_gm;
+        PORTCFG.MPCMASK = DCDC_PG_gm;
+        DCDC_PG_PORT.PIN0CTRL = PORT_OPC_PULLUP_gc | PORT_ISC_BOTHEDGES_gc;
+        DCDC_PG_PORT.DIRCLR = DCDC_PG_gm;
 
-    if (DCDC_SYNC_gm == 0xf0) {
-        P5A_SYNC_PORT.REMAP |= (PORT_TC4A_bm | PORT_TC4B_bm | PORT_TC4C_bm | PORT_TC4D_bm);
-    }
+        if (DCDC_SYNC_gm == 0xf0) {
+            // With the 5V pair on TC5, whose outputs are on Px4 and Px5,
+            // TC4 A and B are left on their unused default pins.
+            P5A_SYNC_PORT.REMAP |= DCDC_P5_TC5
+                ? (PORT_TC4C_bm | PORT_TC4D_bm)
+                : (PORT_TC4A_bm | PORT_TC4B_bm | PORT_TC4C_bm | PORT_TC4D_bm);
+        }
 
-    DCDC_TIMER.CTRLA = TC45_CLKSEL_DIV1_gc;
-    DCDC_TIMER.CTRLB = TC45_WGMODE_FRQ_gc;
+        dcdc_timer_init(&DCDC_TIMER, DCDC_FREQUENCY);
+        if (DCDC_P5_TC5) {
+            dcdc_timer_init((TC4_t volatile *) &DCDC_P5_TIMER, DCDC_P5_FREQUENCY);
+        }
+    }
 
-    // From XMEGA AU manual, p 172:
-    // fFRQ = fclkper / (2 PRESC (CCA + 1))
-    DCDC_TIMER.CCA = (uint16_t) (F_CPU / (2 * /* presc */ 1 * DCDC_FREQUENCY) - 1 + 0.5);
+    if (DCDC_PWM) {
+        reg_buck_set_inversion(reg, false);
+    }
 
     return false;
 }
 
-static bool reg_buck_enable(regptr reg, bool sync)
+// Return the soft-starting buck whose frequency ramp currently owns a sync
+// timer, or NULL.
+static regptr dcdc_ramp_owner(TC4_t volatile * timer)
 {
-    if (sync) {
-        PORTCFG.MPCMASK = reg__buck(reg)->sync_bm;
-        reg__buck(reg)->sync_port->PIN0CTRL =
-            PORT_OPC_TOTEM_gc |
-            (reg__buck(reg)->phase_180 ? PORT_INVEN_bm : 0);
-        DCDC_TIMER.CTRLE |= reg__buck(reg)->sync_cc_bm;
+    for (uint8_t i = 0; i < sizeof(bucks) / sizeof(bucks[0]); ++i) {
+        struct reg_buck_state * state = reg__buck(bucks[i])->state;
+        if (reg__buck(bucks[i])->timer == timer &&
+                state->ss_left && state->ss_top) {
+            return bucks[i];
+        }
+    }
+    return NULL;
+}
+
+// Top value the timer is meant to run at, not counting soft-start ramps
+static uint16_t dcdc_target_top(TC4_t volatile * timer)
+{
+    regptr owner = dcdc_ramp_owner(timer);
+    return owner ? reg__buck(owner)->state->ss_top : dcdc_top_of(timer);
+}
+
+// Whether no other buck is running from this buck's sync timer
+static bool reg_buck_timer_free(regptr reg)
+{
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+    for (uint8_t i = 0; i < sizeof(bucks) / sizeof(bucks[0]); ++i) {
+        if (reg__buck(bucks[i])->timer == timer && bucks[i] != reg &&
+                reg__buck(bucks[i])->state->mode == BUCK_SYNC) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Gate the buck's SYNC output. In PWM mode this is a single write to the
+// compare buffer, so the output is switched at a period boundary and never
+// produces a runt pulse; the latency is recorded. In frequency mode the
+// compare output is switched over to the port directly.
+static void reg_buck_connect(regptr reg, uint8_t mode)
+{
+    struct reg_buck_state * state = reg__buck(reg)->state;
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+
+    state->mode = mode;
+    if (DCDC_PWM) {
+        uint16_t latency = reg_buck_load_cc(reg);
+        if (latency > state->gate_latency) {
+            state->gate_latency = latency;
+        }
+    } else if (mode == BUCK_SYNC) {
+        reg_buck_set_pinctrl(reg, reg_buck_pinctrl(reg));
+        timer->CTRLE |= reg__buck(reg)->sync_cc_bm;
+    } else {
+        timer->CTRLE &= ~(reg__buck(reg)->sync_cc_bm);
+        reg_buck_set_pinctrl(reg, PORT_OPC_TOTEM_gc);
+        if (mode == BUCK_UNSYNC) {
+            reg__buck(reg)->sync_port->OUTSET = reg__buck(reg)->sync_bm;
+        } else {
+            reg__buck(reg)->sync_port->OUTCLR = reg__buck(reg)->sync_bm;
+        }
+    }
+}
+
+// End a soft-start early or on time, leaving the buck fully synchronized
+static void reg_buck_ss_finish(regptr reg)
+{
+    struct reg_buck_state * state = reg__buck(reg)->state;
+    if (!state->ss_left) {
+        return;
+    }
+
+    state->ss_left = 0;
+    if (state->ss_top) {
+        dcdc_load_top(reg__buck(reg)->timer, state->ss_top);
+        state->ss_top = 0;
+    } else {
+        reg_buck_connect(reg, BUCK_SYNC);
+    }
+}
+
+// Start the buck with a soft-start profile. If nothing else runs from its
+// sync timer, the timer starts at DCDC_SS_FREQUENCY and is ramped up to its
+// target frequency; otherwise, the buck runs unsynchronized until the
+// soft-start time is up.
+static void reg_buck_ss_start(regptr reg)
+{
+    struct reg_buck_state * state = reg__buck(reg)->state;
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+
+    if (reg_buck_timer_free(reg) && !dcdc_ramp_owner(timer)) {
+        state->ss_top = dcdc_top_of(timer);
+        dcdc_load_top(timer, dcdc_top(DCDC_SS_FREQUENCY));
+        reg_buck_connect(reg, BUCK_SYNC);
     } else {
-        reg__buck(reg)->sync_port->OUTSET = reg__buck(reg)->sync_bm;
-        DCDC_TIMER.CTRLE &= ~(reg__buck(reg)->sync_cc_bm);
+        state->ss_top = 0;
+        reg_buck_connect(reg, BUCK_UNSYNC);
+    }
+    // Changes to ss_ms take effect from the next soft-start
+    state->ss_len = state->ss_left = state->ss_ms;
+}
+
+static bool reg_buck_enable(regptr reg, bool sync)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!reg_buck_is_enabled(reg)) {
+            pgtime_start(reg);
+            evlog(EV_ENABLE, reg_id_of(reg));
+        }
+        if (sync && reg__buck(reg)->state->ss_ms && !reg_buck_is_enabled(reg)) {
+            reg_buck_ss_start(reg);
+        } else {
+            reg_buck_ss_finish(reg);
+            reg_buck_connect(reg, sync ? BUCK_SYNC : BUCK_UNSYNC);
+        }
     }
     return false;
 }
 
 static bool reg_buck_disable(regptr reg)
 {
-    DCDC_TIMER.CTRLE &= ~(reg__buck(reg)->sync_cc_bm);
-    PORTCFG.MPCMASK = reg__buck(reg)->sync_bm;
-    reg__buck(reg)->sync_port->PIN0CTRL = PORT_OPC_TOTEM_gc;
-    reg__buck(reg)->sync_port->OUTCLR = reg__buck(reg)->sync_bm;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (reg_buck_is_enabled(reg)) {
+            evlog(EV_DISABLE, reg_id_of(reg));
+        }
+        pgtime_cancel(reg);
+        reg_buck_ss_finish(reg);
+        reg_buck_connect(reg, BUCK_OFF);
+    }
     return false;
 }
 
 static bool reg_buck_is_enabled(regptr reg)
 {
-    return
-        (DCDC_TIMER.CTRLE & reg__buck(reg)->sync_cc_bm) ||
-        (reg__buck(reg)->sync_port->OUT & reg__buck(reg)->sync_bm);
+    return reg__buck(reg)->state->mode != BUCK_OFF;
 }
 
 static bool reg_buck_is_power_good(regptr reg)
@@ -122,6 +415,149 @@ static bool reg_buck_is_power_good(regptr reg)
         reg_buck_is_enabled(reg);
 }
 
+bool reg_is_buck(regptr reg)
+{
+    return reg->probe == reg_buck_probe;
+}
+
+void reg_buck_reattach(regptr reg)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        dcdc_wait_update(reg__buck(reg)->timer);
+        reg__buck(reg)->sync_port->DIRSET = reg__buck(reg)->sync_bm;
+        // In frequency mode, a disabled buck's pin is driven by OUT
+        reg_buck_set_pinctrl(reg,
+                DCDC_PWM ? reg_buck_pinctrl(reg) : PORT_OPC_TOTEM_gc);
+    }
+}
+
+// Apply a phase or duty change from the buck's state
+static void reg_buck_update(regptr reg, bool was_inverted)
+{
+    bool inverted = reg__buck(reg)->state->phase != 0;
+
+    if (DCDC_PWM) {
+        if (inverted != was_inverted) {
+            reg_buck_set_inversion(reg, was_inverted);
+        }
+        reg_buck_load_cc(reg);
+    } else if (reg__buck(reg)->state->mode == BUCK_SYNC) {
+        // Frequency mode: flip the inversion right after a period boundary
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            dcdc_wait_update(reg__buck(reg)->timer);
+            reg_buck_set_pinctrl(reg, reg_buck_pinctrl(reg));
+        }
+    }
+}
+
+bool reg_buck_set_phase(regptr reg, uint8_t phase)
+{
+    if (!DCDC_PWM && phase != 0 && phase != 128) {
+        return true;
+    }
+    if (DCDC_PWM && phase && !reg_buck_duty_ok(reg, (uint8_t) (256 - phase))) {
+        return true;
+    }
+
+    bool was_inverted = reg__buck(reg)->state->phase != 0;
+    reg__buck(reg)->state->phase = phase;
+    reg_buck_update(reg, was_inverted);
+    return false;
+}
+
+uint8_t reg_buck_get_phase(regptr reg)
+{
+    return reg__buck(reg)->state->phase;
+}
+
+bool reg_buck_set_duty(regptr reg, uint8_t duty)
+{
+    if (!DCDC_PWM || !reg_buck_duty_ok(reg, duty)) {
+        return true;
+    }
+
+    reg__buck(reg)->state->duty = duty;
+    reg_buck_update(reg, reg__buck(reg)->state->phase != 0);
+    return false;
+}
+
+uint8_t reg_buck_get_duty(regptr reg)
+{
+    uint8_t phase = reg__buck(reg)->state->phase;
+    if (!DCDC_PWM) {
+        return 128;
+    } else if (phase) {
+        return (uint8_t) (256 - phase);
+    } else {
+        return reg__buck(reg)->state->duty;
+    }
+}
+
+bool reg_buck_set_frequency(regptr reg, uint32_t freq)
+{
+    if (freq < DCDC_FREQUENCY_MIN || freq > DCDC_FREQUENCY_MAX) {
+        return true;
+    }
+
+    TC4_t volatile * timer = reg__buck(reg)->timer;
+    uint16_t top = dcdc_top(freq);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        regptr owner = dcdc_ramp_owner(timer);
+        if (owner) {
+            // Soft-start ramp in progress; just move its end point
+            reg__buck(owner)->state->ss_top = top;
+        } else {
+            dcdc_load_top(timer, top);
+        }
+    }
+    return false;
+}
+
+uint32_t reg_buck_get_frequency(regptr reg)
+{
+    uint32_t top = dcdc_target_top(reg__buck(reg)->timer);
+    return DCDC_PWM ? F_CPU / (top + 1) : F_CPU / (2 * (top + 1));
+}
+
+void reg_buck_set_softstart(regptr reg, uint8_t ms)
+{
+    reg__buck(reg)->state->ss_ms = ms;
+}
+
+uint8_t reg_buck_get_softstart(regptr reg)
+{
+    return reg__buck(reg)->state->ss_ms;
+}
+
+uint16_t reg_buck_get_gate_latency(regptr reg)
+{
+    return reg__buck(reg)->state->gate_latency;
+}
+
+void reg_tick(void)
+{
+    for (uint8_t i = 0; i < sizeof(bucks) / sizeof(bucks[0]); ++i) {
+        regptr reg = bucks[i];
+        struct reg_buck_state * state = reg__buck(reg)->state;
+
+        if (!state->ss_left) {
+            continue;
+        } else if (state->ss_left == 1) {
+            reg_buck_ss_finish(reg);
+        } else {
+            --state->ss_left;
+            if (state->ss_top) {
+                // Linear ramp of the period from DCDC_SS_FREQUENCY
+                uint16_t start = dcdc_top(DCDC_SS_FREQUENCY);
+                uint16_t top = state->ss_top +
+                    (uint32_t) (start - state->ss_top) * state->ss_left / state->ss_len;
+                dcdc_load_top(reg__buck(reg)->timer, top);
+            }
+        }
+    }
+}
+
 static bool reg_inv_probe(regptr reg)
 {
     (void) reg;
@@ -131,12 +567,20 @@ static bool reg_inv_probe(regptr reg)
 static bool reg_inv_enable(regptr reg, bool sync)
 {
     (void) sync;
+    if (!reg_inv_is_enabled(reg)) {
+        pgtime_start(reg);
+        evlog(EV_ENABLE, reg_id_of(reg));
+    }
     reg__inv(reg)->en_port->OUTSET = reg__inv(reg)->en_bm;
     return false;
 }
 
 static bool reg_inv_disable(regptr reg)
 {
+    if (reg_inv_is_enabled(reg)) {
+        evlog(EV_DISABLE, reg_id_of(reg));
+    }
+    pgtime_cancel(reg);
     reg__inv(reg)->en_port->OUTCLR = reg__inv(reg)->en_bm;
     return false;
 }
@@ -148,10 +592,8 @@ static bool reg_inv_is_enabled(regptr reg)
 
 static bool reg_inv_is_power_good(regptr reg)
 {
+    // Dependencies on other supplies are handled by the sequencer
     return
         (reg_inv_is_enabled(reg)) &&
-        (reg__inv(reg)->pg_port->IN & reg__inv(reg)->pg_bm) &&
-        reg_is_power_good(reg_P3B) &&   // Dependency for clock to drive DC restorer
-        (reg_is_power_good(reg_P5A) ||  // Dependency for power
-         reg_is_power_good(reg_P5B));   // Dependency for power
+        (reg__inv(reg)->pg_port->IN & reg__inv(reg)->pg_bm);
 }
@@ -4,6 +4,7 @@
 #include "hardware.h"
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 struct regulator;
 typedef struct regulator const __memx * regptr;
@@ -40,14 +41,47 @@ struct regulator {
 #define reg_is_enabled(reg)     ((reg)->is_enabled((reg)))
 #define reg_is_power_good(reg)  ((reg)->is_power_good((reg)))
 
+enum reg_buck_mode {
+    BUCK_OFF,
+    BUCK_UNSYNC,    // SYNC held high, converter on its own oscillator
+    BUCK_SYNC,      // SYNC driven by the sync timer
+};
+
+// Runtime settings of a buck regulator, kept in RAM
+struct reg_buck_state {
+    // enum reg_buck_mode
+    uint8_t mode;
+    // Phase of the SYNC output's rising edge, in 1/256 of a period
+    uint8_t phase;
+    // Pulse width of the SYNC output at phase 0, in 1/256 of a period
+    uint8_t duty;
+    // Soft-start time in ms, or 0 to synchronize immediately on enable
+    uint8_t ss_ms;
+    // Length of the running soft-start in ms, as of its start
+    uint8_t ss_len;
+    // Time left in the running soft-start in ms, or 0 if none is running
+    uint8_t ss_left;
+    // Top value to ramp the sync timer up to, or 0 if starting unsynchronized
+    uint16_t ss_top;
+    // Longest measured delay from gating the SYNC output on or off until it
+    // took effect, in timer cycles
+    uint16_t gate_latency;
+};
+
 struct reg_buck {
     struct regulator base;
+    struct reg_buck_state * state;
+    // Sync timer. May be a TC5, which is register-compatible with TC4 for
+    // compare channels A and B.
+    TC4_t volatile * timer;
     PORT_t volatile * sync_port;
     PORT_t volatile * pg_port;
     uint8_t sync_bm;
     uint8_t pg_bm;
     uint8_t sync_cc_bm;
-    bool    phase_180;
+    uint8_t sync_cc;    // compare channel index, 0 = A
+    uint8_t duty_min;   // SYNC pulse width limits, in 1/256 of a period
+    uint8_t duty_max;
 };
 
 struct reg_inv {
@@ -65,10 +99,170 @@ struct reg_inv {
 #define reg__buck(reg)  ((struct reg_buck const __memx *) (reg))
 #define reg__inv(reg)   ((struct reg_inv const __memx *) (reg))
 
+// Return whether reg is a buck regulator, i.e. whether the reg_buck_*
+// functions may be called on it.
+bool reg_is_buck(regptr reg);
+
+// Drive a disabled buck's SYNC output again after the power-fail interrupt
+// released it onto its pull-down. Waits for a period boundary so the timer
+// is holding the output low first.
+void reg_buck_reattach(regptr reg);
+
+// Set the phase of a buck's SYNC output, in 1/256 of a period. Without
+// DCDC_PWM, only 0 and 128 (180 degrees) are supported. The change takes
+// effect at the next period boundary of the buck's sync timer.
+//
+// A compare channel only controls one edge per period. At phase 0 the pulse
+// starts at the period boundary and its width is set by the duty cycle; at
+// any other phase it lasts until the end of the period, so its width is
+// (256 - phase). Either way the width must be within the buck's limits.
+// @return true on error
+bool reg_buck_set_phase(regptr reg, uint8_t phase);
+
+// Return the phase of a buck's SYNC output, in 1/256 of a period.
+uint8_t reg_buck_get_phase(regptr reg);
+
+// Set the SYNC pulse width of a buck at phase 0, in 1/256 of a period. Only
+// supported with DCDC_PWM, and must be within the buck's limits. The change
+// takes effect at the next period boundary, through the compare buffer.
+// @return true on error
+bool reg_buck_set_duty(regptr reg, uint8_t duty);
+
+// Return the SYNC pulse width of a buck as currently generated, in 1/256 of
+// a period.
+uint8_t reg_buck_get_duty(regptr reg);
+
+// Set the sync frequency of a buck, in Hz. This applies to every buck sharing
+// its sync timer, at the next period boundary, and keeps their phases.
+// @return true on error (frequency out of range)
+bool reg_buck_set_frequency(regptr reg, uint32_t freq);
+
+// Return the sync frequency of a buck, in Hz.
+uint32_t reg_buck_get_frequency(regptr reg);
+
+// Set the soft-start time of a buck in ms, 0 to disable. When enabled
+// synchronized from the off state, a buck with a soft-start time first runs
+// at a reduced sync frequency ramping up to the target (if it is the only
+// buck on its sync timer) or unsynchronized, and is fully synchronized once
+// the time is up.
+void reg_buck_set_softstart(regptr reg, uint8_t ms);
+
+// Return the soft-start time of a buck in ms.
+uint8_t reg_buck_get_softstart(regptr reg);
+
+// Return the longest delay seen between enabling or disabling a buck and its
+// SYNC output following, in CPU cycles. PWM mode only; bounded by one sync
+// period.
+uint16_t reg_buck_get_gate_latency(regptr reg);
+
+// Advance soft-start ramps. Call once per millisecond, from the tick
+// interrupt.
+void reg_tick(void);
+
 extern reg_type * reg_P5A;
 extern reg_type * reg_P5B;
 extern reg_type * reg_P3A;
 extern reg_type * reg_P3B;
 extern reg_type * reg_N12;
 
+// Supplies, as X-macros over their hardware.h names.
+#define REG_BUCKS(X)    X(P5A) X(P5B) X(P3A) X(P3B)
+#define REG_INVS(X)     X(N12)
+
+enum reg_id {
+#define X(name) CONCAT(REG_ID_, name),
+    REG_BUCKS(X)
+    REG_INVS(X)
+#undef X
+    REG_N_IDS
+};
+
+// Number of bucks, which take the IDs below it
+#define REG__COUNT(name)    + 1
+#define REG_N_BUCKS         (0 REG_BUCKS(REG__COUNT))
+
+#define X(name) extern struct reg_buck_state CONCAT(CONCAT(reg_, name), _state);
+REG_BUCKS(X)
+#undef X
+
+// Return the regulator for a supply ID.
+static inline regptr reg_of_id(uint8_t id)
+{
+    switch (id) {
+#define X(name) case CONCAT(REG_ID_, name): return CONCAT(reg_, name);
+    REG_BUCKS(X)
+    REG_INVS(X)
+#undef X
+    default: return NULL;
+    }
+}
+
+// Return the supply ID of a regulator, or -1.
+static inline int8_t reg_id_of(regptr reg)
+{
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        if (reg_of_id(id) == reg) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// Return the PG pin mask of a supply. All PG pins are on one port.
+static inline uint8_t reg_id_pg_bm(uint8_t id)
+{
+    switch (id) {
+#define X(name) case CONCAT(REG_ID_, name): return bm(CONCAT(name, _PG_bp));
+    REG_BUCKS(X)
+    REG_INVS(X)
+#undef X
+    default: return 0;
+    }
+}
+
+// Static dispatch of the status accessors, for the supervision paths. With a
+// constant ID these compile down to a bit test on the supply's port or state;
+// with a variable one, to a jump table. Either way they avoid the generic
+// pointer loads of the vtable call and of the callee's __memx fields. The
+// behavior matches reg_is_enabled() and reg_is_power_good().
+#define REG__BUCK_ON(name)     (*(uint8_t volatile *) &CONCAT(CONCAT(reg_, name), _state).mode != BUCK_OFF)
+#define REG__INV_ON(name)     (CONCAT(name, _EN_PORT).OUT & bm(CONCAT(name, _EN_bp)))
+#define REG__PG_PIN(name)     (CONCAT(name, _PG_PORT).IN & bm(CONCAT(name, _PG_bp)))
+
+static inline bool reg_id_is_enabled(uint8_t id)
+{
+#if REG_STATIC_DISPATCH
+    switch (id) {
+#define X(name) case CONCAT(REG_ID_, name): return REG__BUCK_ON(name);
+    REG_BUCKS(X)
+#undef X
+#define X(name) case CONCAT(REG_ID_, name): return REG__INV_ON(name);
+    REG_INVS(X)
+#undef X
+    default: return false;
+    }
+#else
+    return reg_is_enabled(reg_of_id(id));
+#endif
+}
+
+static inline bool reg_id_is_power_good(uint8_t id)
+{
+#if REG_STATIC_DISPATCH
+    switch (id) {
+#define X(name) case CONCAT(REG_ID_, name): \
+        return REG__PG_PIN(name) && REG__BUCK_ON(name);
+    REG_BUCKS(X)
+#undef X
+#define X(name) case CONCAT(REG_ID_, name): \
+        return REG__INV_ON(name) && REG__PG_PIN(name);
+    REG_INVS(X)
+#undef X
+    default: return false;
+    }
+#else
+    return reg_is_power_good(reg_of_id(id));
+#endif
+}
+
 #endif // REGULATOR_H
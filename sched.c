@@ -0,0 +1,123 @@
+#include "sched.h"
+#include "hardware.h"
+#include "perf.h"
+#include "wdog.h"
+#include <string.h>
+
+static struct sched_task const * table;
+static uint8_t n_tasks = 0;
+static uint32_t due_ms[SCHED_MAX_TASKS];
+static struct sched_stats stats[SCHED_MAX_TASKS];
+
+void init_sched(struct sched_task const * tasks, uint8_t n)
+{
+    table = tasks;
+    n_tasks = n < SCHED_MAX_TASKS ? n : SCHED_MAX_TASKS;
+
+    uint32_t now = uptime_ms();
+    uint8_t critical_bm = 0;
+    for (uint8_t i = 0; i < n_tasks; ++i) {
+        due_ms[i] = now;
+        if (pgm_read_byte(&table[i].critical) && WDOG_TASK(i) < WDOG_SOURCES) {
+            critical_bm |= bm(WDOG_TASK(i));
+        }
+    }
+    memset(stats, 0, sizeof(stats));
+    wdog_require(critical_bm);
+}
+
+// now is read once per pass, which the standby clock cannot afford per task
+static void run(uint8_t i, bool critical_only, uint32_t now)
+{
+    struct sched_task task;
+    memcpy_P(&task, &table[i], sizeof(task));
+    if (critical_only && !task.critical) {
+        return;
+    }
+
+    int32_t late = now - due_ms[i];
+    if (task.period_ms && late < 0) {
+        return;
+    }
+
+    // Nothing runs more often than the tick wakes the CPU, so in standby a
+    // shorter period is stretched to the tick instead of counting as late
+    uint8_t tick = tick_period_ms();
+    if (task.period_ms && task.period_ms < tick) {
+        task.period_ms = tick;
+    }
+
+    struct sched_stats * s = &stats[i];
+    bool on_time = true;
+    if (task.period_ms) {
+        if (late > s->max_late_ms) {
+            s->max_late_ms = late > UINT16_MAX ? UINT16_MAX : late;
+        }
+        if (late >= task.deadline_ms + tick) {
+            on_time = false;
+            if (s->misses < UINT16_MAX) {
+                ++s->misses;
+            }
+        }
+        due_ms[i] += task.period_ms;
+        if ((int32_t) (now - due_ms[i]) >= 0) {
+            due_ms[i] = now + task.period_ms;
+        }
+    }
+    if (s->runs < UINT16_MAX) {
+        ++s->runs;
+    }
+
+    uint32_t start = perf_now();
+    task.run();
+    if (task.perf_id < PERF_N_IDS) {
+        perf_record(task.perf_id, start);
+    }
+
+    if (task.critical && WDOG_TASK(i) < WDOG_SOURCES) {
+        if (on_time) {
+            wdog_checkin(WDOG_TASK(i));
+        } else {
+            wdog_late(WDOG_TASK(i));
+        }
+    }
+}
+
+void sched_poll(void)
+{
+    uint32_t now = uptime_ms();
+    for (uint8_t i = 0; i < n_tasks; ++i) {
+        run(i, false, now);
+    }
+}
+
+void sched_yield(void)
+{
+    static bool yielding = false;
+    if (yielding) {
+        return;
+    }
+    yielding = true;
+    uint32_t now = uptime_ms();
+    for (uint8_t i = 0; i < n_tasks; ++i) {
+        run(i, true, now);
+    }
+    yielding = false;
+}
+
+uint8_t sched_count(void)
+{
+    return n_tasks;
+}
+
+PGM_P sched_name(uint8_t i)
+{
+    return table[i].name;
+}
+
+struct sched_stats sched_take(uint8_t i)
+{
+    struct sched_stats s = stats[i];
+    memset(&stats[i], 0, sizeof(stats[i]));
+    return s;
+}
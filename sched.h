@@ -0,0 +1,64 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+// Cooperative scheduler. Tasks are listed in a table in flash with a period
+// and a deadline in ms. sched_poll() runs every task that is due, in table
+// order, and the caller sleeps until the next interrupt between polls. With
+// the tick waking the CPU every tick_period_ms(), task rates no longer
+// depend on the clock speed or on how much work the other tasks do.
+//
+// A task with period 0 runs on every poll; this is for tasks that wait on
+// something an interrupt provides, like received characters. Critical tasks
+// check in with the watchdog (see wdog.h) each time they run within their
+// deadline, and also run from sched_yield() while another task waits. A periodic
+// task that starts more than its deadline plus one tick after it was due
+// has missed its deadline. A task that falls more than a period behind
+// skips the runs it missed rather than running back to back. A period
+// shorter than the tick, as in standby, is stretched to one tick.
+
+#define SCHED_NAME_LEN  8
+
+struct sched_task {
+    void (* run)(void);
+    uint16_t period_ms;
+    uint16_t deadline_ms;
+    uint8_t perf_id;            // enum perf_id, or PERF_N_IDS for none
+    bool critical;
+    char name[SCHED_NAME_LEN];
+};
+
+struct sched_stats {
+    uint16_t runs;              // saturating
+    uint16_t misses;            // saturating
+    uint16_t max_late_ms;
+};
+
+/**
+ * Start scheduling tasks. Every periodic task is due at once. Critical
+ * tasks must be among the first WDOG_SOURCES - 1.
+ *
+ * @param tasks - table of tasks in flash
+ * @param n - number of tasks, up to SCHED_MAX_TASKS
+ */
+void init_sched(struct sched_task const * tasks, uint8_t n);
+
+// Run every task that is due.
+void sched_poll(void);
+
+// Run the critical tasks that are due. Call from busy-waits in other tasks.
+void sched_yield(void);
+
+// Return the number of tasks.
+uint8_t sched_count(void);
+
+// Return the name of task i, in flash.
+PGM_P sched_name(uint8_t i);
+
+// Return and clear the statistics of task i.
+struct sched_stats sched_take(uint8_t i);
+
+#endif // SCHED_H
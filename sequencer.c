@@ -0,0 +1,217 @@
+#include "sequencer.h"
+#include "hardware.h"
+#include <util/atomic.h>
+
+struct seq_node {
+    uint8_t all_of;     // parents that must all be good
+    uint8_t any_of;     // parents of which one must be good, or 0
+};
+
+// Indexed by supply ID. Parents must come before their children.
+static const struct seq_node nodes[REG_N_IDS] = {
+    [REG_ID_P5A] = { 0, 0 },
+    [REG_ID_P5B] = { 0, 0 },
+    [REG_ID_P3A] = { 0, 0 },
+    [REG_ID_P3B] = { 0, 0 },
+    // P3B clocks the DC restorer; either 5V supply powers the inverter
+    [REG_ID_N12] = { bm(REG_ID_P3B), bm(REG_ID_P5A) | bm(REG_ID_P5B) },
+};
+
+// Delay from parents good to enable, in ms
+static uint8_t delays[REG_N_IDS] = {
+    [REG_ID_N12] = N12_DELAY_MS,
+};
+
+static volatile uint8_t requested_bm = 0;
+static volatile uint8_t held_bm = 0;
+// wanted() as of the last tick, for the supervisor
+static volatile uint8_t wanted_bm = 0;
+// Supplies whose parents are good, and since when
+static uint8_t ready_bm = 0;
+static uint32_t ready_ms[REG_N_IDS];
+
+static bool parents_ok(uint8_t i, uint8_t set)
+{
+    return (set & nodes[i].all_of) == nodes[i].all_of &&
+        (!nodes[i].any_of || (set & nodes[i].any_of));
+}
+
+// Return whether any enabled child of i depends on it.
+static bool is_needed(uint8_t i, uint8_t on)
+{
+    for (uint8_t c = i + 1; c < REG_N_IDS; ++c) {
+        if (!(on & bm(c))) {
+            continue;
+        }
+        if ((nodes[c].all_of & bm(i)) ||
+                ((nodes[c].any_of & on) == bm(i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Requested supplies that are not held off and whose parents are also wanted
+static uint8_t wanted(void)
+{
+    uint8_t want = 0;
+    uint8_t allowed = requested_bm & ~held_bm;
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        if ((allowed & bm(i)) && parents_ok(i, want)) {
+            want |= bm(i);
+        }
+    }
+    return want;
+}
+
+static uint8_t enabled(void)
+{
+    uint8_t on = 0;
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        if (reg_id_is_enabled(i)) {
+            on |= bm(i);
+        }
+    }
+    return on;
+}
+
+void seq_request(regptr reg, bool on)
+{
+    int8_t i = reg_id_of(reg);
+    if (i < 0) {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (on) {
+            requested_bm |= bm(i);
+        } else {
+            requested_bm &= ~bm(i);
+        }
+    }
+}
+
+bool seq_is_requested(regptr reg)
+{
+    int8_t i = reg_id_of(reg);
+    return i >= 0 && (requested_bm & bm(i));
+}
+
+void seq_set_delay(regptr reg, uint8_t ms)
+{
+    int8_t i = reg_id_of(reg);
+    if (i >= 0) {
+        delays[i] = ms;
+    }
+}
+
+uint8_t seq_get_delay(regptr reg)
+{
+    int8_t i = reg_id_of(reg);
+    return i >= 0 ? delays[i] : 0;
+}
+
+void seq_hold(regptr reg, bool hold)
+{
+    int8_t i = reg_id_of(reg);
+    if (i < 0) {
+        return;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (hold) {
+            held_bm |= bm(i);
+        } else {
+            held_bm &= ~bm(i);
+        }
+    }
+}
+
+uint8_t seq_wanted_bm(void)
+{
+    return wanted_bm;
+}
+
+uint8_t seq_requested_bm(void)
+{
+    return requested_bm;
+}
+
+static bool node_power_good(uint8_t i)
+{
+    if (!reg_id_is_power_good(i)) {
+        return false;
+    }
+    uint8_t good = 0;
+    for (uint8_t p = 0; p < i; ++p) {
+        if (((nodes[i].all_of | nodes[i].any_of) & bm(p)) && node_power_good(p)) {
+            good |= bm(p);
+        }
+    }
+    return parents_ok(i, good);
+}
+
+bool seq_is_power_good(regptr reg)
+{
+    int8_t i = reg_id_of(reg);
+    return i >= 0 ? node_power_good(i) : reg_is_power_good(reg);
+}
+
+bool seq_is_settled(void)
+{
+    uint8_t want, on;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        want = wanted();
+        on = enabled();
+    }
+    return want == on;
+}
+
+void seq_tick(void)
+{
+    uint8_t want = wanted();
+    wanted_bm = want;
+
+    // The power-fail interrupt has cut the supplies behind the sequencer's
+    // back; wait for the main loop to clear the requests
+    if (power_fail_latched()) {
+        return;
+    }
+
+    uint32_t now = uptime_ms();
+    uint8_t on = enabled();
+    uint8_t good = 0;
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        if (reg_id_is_power_good(i)) {
+            good |= bm(i);
+        }
+    }
+
+    for (uint8_t i = 0; i < REG_N_IDS; ++i) {
+        regptr reg = reg_of_id(i);
+
+        if (!(want & bm(i))) {
+            ready_bm &= ~bm(i);
+            // Decided on this tick's enabled set, so each level of the tree
+            // goes down at least a tick after its children.
+            if ((on & bm(i)) && !is_needed(i, on)) {
+                reg_disable(reg);
+            }
+            continue;
+        }
+
+        if (on & bm(i)) {
+            continue;
+        }
+
+        if (!parents_ok(i, good)) {
+            ready_bm &= ~bm(i);
+        } else if (!(ready_bm & bm(i))) {
+            ready_bm |= bm(i);
+            ready_ms[i] = now;
+        }
+
+        if ((ready_bm & bm(i)) &&
+                (uint32_t) (now - ready_ms[i]) >= delays[i]) {
+            reg_enable(reg, true);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "regulator.h"
+#include <stdbool.h>
+
+// Power sequencer. Every supply has a set of parents that must all be good,
+// a set of which at least one must be good, and a delay from its parents
+// becoming good until it is enabled. A requested supply is enabled once its
+// parents are good and the delay has passed; supplies are disabled only once
+// no enabled child still depends on them, so shutdown runs in reverse order.
+// Independent branches come up concurrently.
+//
+// A supply whose parents are not requested is not enabled, and one that is
+// enabled is disabled when its parents stop being requested.
+
+// Request a supply on or off. Takes effect on the next tick.
+void seq_request(regptr reg, bool on);
+
+// Return whether a supply is requested on.
+bool seq_is_requested(regptr reg);
+
+// Set the delay from a supply's parents becoming good until it is enabled,
+// in ms.
+void seq_set_delay(regptr reg, uint8_t ms);
+
+// Return the enable delay of a supply in ms.
+uint8_t seq_get_delay(regptr reg);
+
+// Hold a supply off regardless of requests, or release it. Its children are
+// taken down with it.
+void seq_hold(regptr reg, bool hold);
+
+// Return the supplies that are requested, not held, and have their parents
+// wanted, i.e. those the sequencer is working to keep on, as of the last
+// tick. One bit per supply ID.
+uint8_t seq_wanted_bm(void);
+
+// Return the supplies requested on, one bit per supply ID.
+uint8_t seq_requested_bm(void);
+
+// Return whether a supply and its parents are all power-good.
+bool seq_is_power_good(regptr reg);
+
+// Return whether every requested supply is enabled and every other one is
+// disabled.
+bool seq_is_settled(void);
+
+// Advance the sequencer. Called from the tick interrupt.
+void seq_tick(void);
+
+#endif // SEQUENCER_H
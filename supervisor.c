@@ -0,0 +1,209 @@
+#include "supervisor.h"
+#include "sequencer.h"
+#include "evlog.h"
+#include "hardware.h"
+#include <util/atomic.h>
+
+struct sup_supply {
+    struct sup_stats stats;
+    uint32_t since_ms;      // time of the last state change
+    uint16_t off_ms;        // off-time of the running backoff
+    uint8_t low_count;      // deglitch filter
+};
+
+static struct sup_supply supplies[REG_N_IDS] = {
+#define X(name) [CONCAT(REG_ID_, name)] = \
+    { .stats = { \
+        .retry_limit = SUP_RETRY_LIMIT, \
+        .deglitch = SUP_DEGLITCH_SAMPLES } },
+    REG_BUCKS(X)
+    REG_INVS(X)
+#undef X
+};
+
+static void enter(struct sup_supply * sup, uint8_t state, uint32_t now)
+{
+    sup->stats.state = state;
+    sup->since_ms = now;
+    sup->low_count = 0;
+    evlog(EV_SUPERVISION, (uint8_t) ((sup - supplies) << 4) | state);
+}
+
+// Run the deglitch filter on a PG sample.
+// @return true when PG counts as lost
+static bool pg_lost(struct sup_supply * sup, bool pg)
+{
+    if (pg) {
+        if (sup->low_count) {
+            --sup->low_count;
+        }
+        return false;
+    }
+    return ++sup->low_count >= sup->stats.deglitch;
+}
+
+static void fault(uint8_t id, uint32_t now)
+{
+    struct sup_supply * sup = &supplies[id];
+    regptr reg = reg_of_id(id);
+
+    reg_disable(reg);
+    seq_hold(reg, true);
+    if (sup->stats.faults < UINT16_MAX) {
+        ++sup->stats.faults;
+    }
+    if (sup->stats.failures < UINT8_MAX) {
+        ++sup->stats.failures;
+    }
+
+    if (sup->stats.failures > sup->stats.retry_limit) {
+        if (sup->stats.latches < UINT8_MAX) {
+            ++sup->stats.latches;
+        }
+        enter(sup, SUP_LATCHED, now);
+        return;
+    }
+
+    uint16_t off_ms = SUP_RETRY_OFF_MS;
+    for (uint8_t i = 1; i < sup->stats.failures && off_ms < SUP_RETRY_MAX_MS; ++i) {
+        off_ms *= 2;
+    }
+    sup->off_ms = off_ms < SUP_RETRY_MAX_MS ? off_ms : SUP_RETRY_MAX_MS;
+    enter(sup, SUP_BACKOFF, now);
+}
+
+static void release(uint8_t id, uint32_t now)
+{
+    seq_hold(reg_of_id(id), false);
+    enter(&supplies[id], SUP_OFF, now);
+}
+
+void sup_tick(void)
+{
+    uint32_t now = uptime_ms();
+    uint8_t want = seq_wanted_bm();
+    uint8_t requested = seq_requested_bm();
+
+    for (uint8_t id = 0; id < REG_N_IDS; ++id) {
+        struct sup_supply * sup = &supplies[id];
+        bool en = reg_id_is_enabled(id);
+        // A supply the sequencer is taking down, e.g. after its parent
+        // faulted, may lose PG before it is disabled. That is not its fault.
+        bool pg = reg_id_is_power_good(id) || !(want & bm(id));
+        uint32_t elapsed = now - sup->since_ms;
+
+        switch (sup->stats.state) {
+        case SUP_OFF:
+            if (en) {
+                enter(sup, SUP_SETTLING, now);
+            }
+            break;
+
+        case SUP_SETTLING:
+            if (!en) {
+                enter(sup, SUP_OFF, now);
+            } else if (pg) {
+                enter(sup, SUP_GOOD, now);
+            } else if (elapsed >= SUP_SETTLE_MS) {
+                fault(id, now);
+            }
+            break;
+
+        case SUP_GOOD:
+            if (!en) {
+                enter(sup, SUP_OFF, now);
+            } else if (pg_lost(sup, pg)) {
+                fault(id, now);
+            } else if (elapsed >= SUP_SETTLE_MS) {
+                sup->stats.failures = 0;
+                enter(sup, SUP_SUPERVISED, now);
+            }
+            break;
+
+        case SUP_SUPERVISED:
+            if (!en) {
+                enter(sup, SUP_OFF, now);
+            } else if (pg_lost(sup, pg)) {
+                fault(id, now);
+            }
+            break;
+
+        case SUP_BACKOFF:
+            if (!(requested & bm(id))) {
+                sup->stats.failures = 0;
+                release(id, now);
+            } else if (elapsed >= sup->off_ms) {
+                if (sup->stats.retries < UINT16_MAX) {
+                    ++sup->stats.retries;
+                }
+                release(id, now);
+            }
+            break;
+
+        case SUP_LATCHED:
+            if (!(requested & bm(id))) {
+                sup->stats.failures = 0;
+                release(id, now);
+            }
+            break;
+        }
+    }
+}
+
+struct sup_stats sup_get(regptr reg)
+{
+    struct sup_stats stats = {0};
+    int8_t id = reg_id_of(reg);
+    if (id >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            stats = supplies[id].stats;
+        }
+    }
+    return stats;
+}
+
+void sup_set_retry_limit(regptr reg, uint8_t limit)
+{
+    int8_t id = reg_id_of(reg);
+    if (id >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            supplies[id].stats.retry_limit = limit;
+        }
+    }
+}
+
+void sup_set_deglitch(regptr reg, uint8_t samples)
+{
+    int8_t id = reg_id_of(reg);
+    if (id >= 0) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            supplies[id].stats.deglitch = samples ? samples : 1;
+            supplies[id].low_count = 0;
+        }
+    }
+}
+
+uint16_t sup_get_deglitch_latency(regptr reg)
+{
+    // The first low sample comes within a tick of PG falling either way, so
+    // the filter adds the remaining samples.
+    return (uint16_t) (sup_get(reg).deglitch - 1) * tick_period_ms();
+}
+
+bool sup_is_power_good(regptr reg)
+{
+    int8_t id = reg_id_of(reg);
+    if (id < 0) {
+        return reg_is_power_good(reg);
+    }
+    uint8_t state = supplies[id].stats.state;
+    return reg_id_is_power_good(id) ||
+        ((state == SUP_GOOD || state == SUP_SUPERVISED) &&
+         supplies[id].low_count < supplies[id].stats.deglitch);
+}
+
+bool sup_is_faulted(regptr reg)
+{
+    uint8_t state = sup_get(reg).state;
+    return state == SUP_BACKOFF || state == SUP_LATCHED;
+}
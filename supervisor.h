@@ -0,0 +1,64 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include "regulator.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Power-good supervision with hiccup retry. After a supply is enabled, its PG
+// must come up within SUP_SETTLE_MS and stay good for another SUP_SETTLE_MS
+// to count as settled; from then on any loss of PG is a fault. A faulted
+// supply is disabled at once and held off by the sequencer for an off-time
+// starting at SUP_RETRY_OFF_MS and doubling with each consecutive failure up
+// to SUP_RETRY_MAX_MS, then released to be enabled again. After more than
+// its retry limit of consecutive failures it latches off until it is
+// requested off and on again.
+//
+// Loss of PG goes through a deglitch filter: an up/down counter sampled once
+// per tick that counts up while PG is low and down while it is high, and
+// declares the fault when it reaches the supply's threshold. A solid fault is
+// detected after exactly threshold ticks; noise has to hold PG low for more
+// than half the samples to accumulate. A threshold of 1 disables the filter.
+
+enum sup_state {
+    SUP_OFF,
+    SUP_SETTLING,   // enabled, waiting for PG
+    SUP_GOOD,       // PG up, not yet settled
+    SUP_SUPERVISED,
+    SUP_BACKOFF,    // faulted, held off until the retry
+    SUP_LATCHED,    // faulted too often, held off
+};
+
+struct sup_stats {
+    uint8_t state;          // enum sup_state
+    uint8_t retry_limit;    // retries after consecutive failures
+    uint8_t failures;       // consecutive failures
+    uint8_t latches;
+    uint8_t deglitch;       // filter threshold in samples
+    uint16_t faults;
+    uint16_t retries;
+};
+
+// Return the supervision state and statistics of a supply.
+struct sup_stats sup_get(regptr reg);
+
+// Set the number of retries of a supply, 0 to latch off on the first fault.
+void sup_set_retry_limit(regptr reg, uint8_t limit);
+
+// Set the deglitch threshold of a supply in samples, at least 1.
+void sup_set_deglitch(regptr reg, uint8_t samples);
+
+// Return the worst-case delay the deglitch filter adds to detecting a fault
+// of a supply, in ms, at the current tick rate.
+uint16_t sup_get_deglitch_latency(regptr reg);
+
+// Return whether a supply's PG is good after filtering.
+bool sup_is_power_good(regptr reg);
+
+// Return whether a supply is held off after a fault.
+bool sup_is_faulted(regptr reg);
+
+// Advance supervision. Called from the tick interrupt.
+void sup_tick(void);
+
+#endif // SUPERVISOR_H
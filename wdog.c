@@ -0,0 +1,107 @@
+#include "wdog.h"
+#include "hardware.h"
+#include "evlog.h"
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+
+#define WDOG_MAGIC  0x57d0
+
+// Check-ins come once per tick, so in standby the feed comes on the first
+// tick at least WDOG_OPEN_MS after the last. That must leave the timeout
+// the same margin for the ULP oscillator's error as at full speed.
+#define WDOG_STANDBY_FEED_MS \
+    ((WDOG_OPEN_MS + STANDBY_TICK_MS - 1) / STANDBY_TICK_MS * STANDBY_TICK_MS)
+_Static_assert(WDOG_STANDBY_FEED_MS * 2 <= WDOG_TIMEOUT_MS,
+        "standby feed interval too close to the watchdog timeout");
+
+// Kept across watchdog resets
+static struct {
+    uint16_t magic;
+    uint8_t pending_bm;     // required sources not checked in since the feed
+    uint8_t late_bm;        // sources that missed a deadline since the feed
+} saved __attribute__((section(".noinit")));
+
+static volatile uint8_t required_bm = bm(WDOG_TICK);
+static uint32_t fed_ms;
+static uint16_t max_interval_ms = 0;
+static uint8_t last_reset_bm = 0;
+
+static void wdt_sync(void)
+{
+    while (WDT.STATUS & WDT_SYNCBUSY_bm);
+}
+
+static void feed(uint32_t now)
+{
+    wdt_reset();
+    uint32_t interval = now - fed_ms;
+    if (interval > max_interval_ms) {
+        max_interval_ms = interval > UINT16_MAX ? UINT16_MAX : interval;
+    }
+    fed_ms = now;
+    saved.pending_bm = required_bm;
+    saved.late_bm = 0;
+}
+
+void init_wdog(void)
+{
+    if ((RST.STATUS & RST_WDRF_bm) && saved.magic == WDOG_MAGIC) {
+        last_reset_bm = saved.pending_bm | saved.late_bm;
+        evlog(EV_WATCHDOG, last_reset_bm);
+    }
+
+    saved.magic = WDOG_MAGIC;
+    saved.pending_bm = required_bm;
+    saved.late_bm = 0;
+    fed_ms = uptime_ms();
+
+    wdt_sync();
+    _PROTECTED_WRITE(WDT.CTRL, WDOG_PER | WDT_ENABLE_bm | WDT_CEN_bm);
+    wdt_sync();
+    wdt_reset();
+    // The window can only be enabled while it is open, i.e. right after a
+    // reset of the WDT
+    _PROTECTED_WRITE(WDT.WINCTRL, WDOG_WPER | WDT_WEN_bm | WDT_WCEN_bm);
+    wdt_sync();
+}
+
+void wdog_require(uint8_t sources_bm)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        required_bm = sources_bm | bm(WDOG_TICK);
+        saved.pending_bm = required_bm;
+    }
+}
+
+void wdog_checkin(uint8_t source)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        saved.pending_bm &= ~bm(source);
+        uint32_t now = uptime_ms();
+        if (!saved.pending_bm && now - fed_ms >= WDOG_OPEN_MS) {
+            feed(now);
+        }
+    }
+}
+
+void wdog_late(uint8_t source)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        saved.late_bm |= bm(source);
+    }
+}
+
+uint8_t wdog_last_reset(void)
+{
+    return last_reset_bm;
+}
+
+uint16_t wdog_max_interval_ms(void)
+{
+    uint16_t n;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        n = max_interval_ms;
+    }
+    return n;
+}
@@ -0,0 +1,48 @@
+#ifndef WDOG_H
+#define WDOG_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Windowed watchdog. The WDT resets the MCU unless it is fed in its open
+// window, between WDOG_CLOSED_MS and WDOG_TIMEOUT_MS after the last feed,
+// so feeding too often is caught as well as not feeding at all.
+//
+// It is only fed once every required source has checked in since the last
+// feed: the tick interrupt, which runs supervision, and each critical
+// scheduler task that ran within its deadline. Checking in is interrupt
+// safe, and feeding happens from whichever check-in completes the set once
+// the window is open. The sources still missing at each moment are kept in
+// SRAM that survives a watchdog reset, so the next boot can tell which one
+// stopped.
+//
+// The time the card can go unsupervised is bounded by WDOG_TIMEOUT_MS plus
+// the reset time.
+
+// Source bits. Scheduler task i is WDOG_TASK(i).
+#define WDOG_TICK       0
+#define WDOG_TASK(i)    ((i) + 1)
+#define WDOG_SOURCES    8
+
+// Enable the watchdog, with only the tick required. If the last reset came
+// from the watchdog, log EV_WATCHDOG with the sources that had not checked
+// in. Must be called before RST.STATUS is cleared.
+void init_wdog(void);
+
+// Set the sources, as a bitmask, that must check in before each feed.
+void wdog_require(uint8_t sources_bm);
+
+// Check in a source.
+void wdog_checkin(uint8_t source);
+
+// Record that a source missed a deadline and did not check in.
+void wdog_late(uint8_t source);
+
+// Return the sources that had not checked in at the last watchdog reset,
+// or 0 if the last reset was not from the watchdog.
+uint8_t wdog_last_reset(void);
+
+// Return the longest time between two feeds, in ms.
+uint16_t wdog_max_interval_ms(void);
+
+#endif // WDOG_H